@@ -0,0 +1,131 @@
+#pragma once
+#include "SpinLock.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <stdlib.h>
+#include <new>
+
+namespace Kuai
+{
+    /**
+     * The bucket layouts decide where the lock and the split sequence number of a bucket are. A layout provides the
+     * template Layout on the lock type. The buckets of ConHashMap derive from Layout::BucketBase, and the map finds the
+     * lock and the sequence number of a bucket by Layout::lockOf() and Layout::splitSeqOf()
+     * */
+    template <typename Lock>
+    struct BucketSync
+    {
+        Lock bucketLock;
+        // odd when the bucket is being split. Readers which do not find the key should retry if it is changed
+        std::atomic<uint32_t> splitSeq = {0};
+    };
+
+    /**
+     * The lock is in the bucket. A bucket takes 16 bytes, and a writer locking a bucket invalidates the cache line of the
+     * readers of the 3 neighboring buckets
+     * */
+    struct LayoutInlineLock
+    {
+        template <typename Lock>
+        struct Layout
+        {
+            struct BucketBase : BucketSync<Lock>
+            {
+            };
+
+            Layout(size_t numStripes) {}
+
+            Lock &lockOf(BucketBase &buck, size_t idx)
+            {
+                return buck.bucketLock;
+            }
+
+            std::atomic<uint32_t> &splitSeqOf(BucketBase &buck, size_t idx)
+            {
+                return buck.splitSeq;
+            }
+        };
+    };
+
+    /**
+     * The buckets only hold the head pointers, 8 buckets per cache line, and are only written when the lists are changed.
+     * The locks are in a separate array of stripes, each of which takes a cache line. Bucket i uses stripe (i % numStripes).
+     * The split sequence numbers, which lock-free readers load, are packed in another array which is only written by the
+     * splits, so the readers never touch the cache lines of the locks
+     * */
+    struct LayoutStripedLock
+    {
+        template <typename Lock>
+        struct Layout
+        {
+            struct BucketBase
+            {
+            };
+
+            struct alignas(64) Stripe
+            {
+                Lock bucketLock;
+            };
+
+            Stripe *stripes;
+            std::atomic<uint32_t> *splitSeqs;
+            size_t stripeMask;
+
+            /**
+             * The number of stripes is rounded up to a power of 2. If it is 0, use 16 stripes per hardware thread
+             * */
+            Layout(size_t numStripes)
+            {
+                if (numStripes == 0)
+                {
+                    numStripes = std::thread::hardware_concurrency() * 16;
+                }
+                size_t n = 1;
+                while (n < numStripes)
+                {
+                    n *= 2;
+                }
+                // new does not respect the alignment of Stripe in C++11
+                void *mem = nullptr;
+                if (posix_memalign(&mem, 64, n * sizeof(Stripe)))
+                {
+                    throw std::bad_alloc();
+                }
+                stripes = (Stripe *)mem;
+                for (size_t i = 0; i < n; i++)
+                {
+                    new (stripes + i) Stripe();
+                }
+                splitSeqs = new std::atomic<uint32_t>[n];
+                for (size_t i = 0; i < n; i++)
+                {
+                    splitSeqs[i].store(0, std::memory_order_relaxed);
+                }
+                stripeMask = n - 1;
+            }
+
+            Layout(const Layout &) = delete;
+
+            ~Layout()
+            {
+                for (size_t i = 0; i <= stripeMask; i++)
+                {
+                    stripes[i].~Stripe();
+                }
+                free(stripes);
+                delete[] splitSeqs;
+            }
+
+            Lock &lockOf(BucketBase &buck, size_t idx)
+            {
+                return stripes[idx & stripeMask].bucketLock;
+            }
+
+            std::atomic<uint32_t> &splitSeqOf(BucketBase &buck, size_t idx)
+            {
+                return splitSeqs[idx & stripeMask];
+            }
+        };
+    };
+} // namespace Kuai
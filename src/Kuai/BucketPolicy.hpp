@@ -0,0 +1,583 @@
+#pragma once
+#include "LogicalClock.hpp"
+#include "ThreadSlot.hpp"
+#include "HazardPointer.hpp"
+#include "Stats.hpp"
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+namespace Kuai
+{
+    /**
+     * The retire lists of a deletion queue, indexed by ThreadSlot. The threads without a slot share the last one. The
+     * lists are allocated by the first removal, so the maps which never remove keys do not pay for them
+     * */
+    template <typename DeletionFlag>
+    struct RetireLists
+    {
+        struct alignas(64) List
+        {
+            std::atomic<DeletionFlag *> head = {nullptr};
+            // the approximate length of the list
+            std::atomic<size_t> count = {0};
+        };
+        // the lists allocated so far, which is empty before the first removal
+        struct Range
+        {
+            List *first;
+            List *last;
+            List *begin() const
+            {
+                return first;
+            }
+            List *end() const
+            {
+                return last;
+            }
+        };
+        static constexpr size_t NUM_LISTS = ThreadSlot::MAX_SLOTS + 1;
+        std::atomic<List *> lists = {nullptr};
+
+        RetireLists() = default;
+        RetireLists(const RetireLists &) = delete;
+
+        // the list of the current thread
+        List &local()
+        {
+            List *p = lists.load(std::memory_order_acquire);
+            if (!p)
+            {
+                p = allocate();
+            }
+            return p[ThreadSlot::tls_slot.id];
+        }
+
+        Range all() const
+        {
+            List *p = lists.load(std::memory_order_acquire);
+            return Range{p, p ? p + NUM_LISTS : nullptr};
+        }
+
+        ~RetireLists()
+        {
+            free(lists.load());
+        }
+
+    private:
+        List *allocate()
+        {
+            // new does not respect the alignment of List in C++11
+            void *mem = nullptr;
+            if (posix_memalign(&mem, 64, NUM_LISTS * sizeof(List)))
+            {
+                throw std::bad_alloc();
+            }
+            List *p = (List *)mem;
+            for (size_t i = 0; i < NUM_LISTS; i++)
+            {
+                new (p + i) List();
+            }
+            List *expected = nullptr;
+            if (!lists.compare_exchange_strong(expected, p, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                // another remover allocated them first
+                free(mem);
+                return expected;
+            }
+            return p;
+        }
+    };
+
+    struct PolicyNoRemove
+    {
+        static void updateLocalClock()
+        {
+        }
+        struct DeletionFlag
+        {
+            constexpr bool isDeleted()
+            {
+                return false;
+            }
+        };
+        struct DeletionQueue
+        {
+            typedef void (*Deleter)(DeletionQueue *, DeletionFlag *);
+            // the stat counters of the map
+            StatRecorder statCounters;
+            DeletionQueue(Deleter v) {}
+            void clear() {}
+        };
+        static constexpr bool canRemove = false;
+        static constexpr bool usesHazardPointers = false;
+        template <typename T>
+        static T *protect(const std::atomic<T *> &src, unsigned slot)
+        {
+            return src.load(std::memory_order_acquire);
+        }
+        static void pin(void *p) {}
+        static void enterReadSection() {}
+        static void leaveReadSection() {}
+    };
+
+    struct PolicyCanRemove
+    {
+        static constexpr bool canRemove = true;
+        static constexpr bool usesHazardPointers = false;
+        // the nodes loaded by a thread are protected by its local clock
+        template <typename T>
+        static T *protect(const std::atomic<T *> &src, unsigned slot)
+        {
+            return src.load(std::memory_order_acquire);
+        }
+        static void pin(void *p) {}
+        static void enterReadSection()
+        {
+            ThreadClock::enterReadSection();
+        }
+        static void leaveReadSection()
+        {
+            ThreadClock::leaveReadSection();
+        }
+        static void updateLocalClock()
+        {
+            // sync local clock with global clock, indicating this core has seen the events with logical tick
+            // less than the current global clock
+            ThreadClock::updateLocalClock();
+        }
+
+        struct DeletionFlag
+        {
+            std::atomic<uint64_t> deleteTick = {0};
+            // links the removed nodes in the retire lists
+            DeletionFlag *nextRetired = nullptr;
+            void markDeleted()
+            {
+                // push up the global clock, indicating there is a new event that may not be seen by other cores
+                auto clockv = ++GlobalClock::clock.logicalClock;
+                deleteTick.store(clockv);
+                // update the clock for the current thread because we have already seen it, unless it is in a read section
+                auto &local = ThreadClock::tls_clock;
+                if (!local.readDepth)
+                {
+                    local.logicalClock.store(clockv, std::memory_order::memory_order_relaxed);
+                }
+
+            }
+
+            bool isDeleted()
+            {
+                // It is safe if a thread checks isDeleted before another thread marks it deleted. Since the global clock is increased,
+                // by node deletion and the thread has not yet updated the local lock, the thread's local lock will be less than the
+                // deleteTick
+                return deleteTick.load();
+            }
+        };
+
+        /**
+         * The removed nodes are queued, and freed when all threads have updated their local clocks after the removal. Each
+         * thread pushes the removed nodes to its own retire list, linked through the nodes. A GC pass takes all retire lists
+         * as a generation, computes the safe epoch once, and frees a whole generation when the safe epoch reaches the
+         * global clock at the time the generation was taken.
+         *
+         * By default, the nodes are only freed by explicit GC passes. With a reclaim threshold, a remover runs a GC pass when
+         * its retire list is long enough. With a background reclaimer, the GC passes are run by a thread owned by the queue
+         * */
+        struct DeletionQueue
+        {
+            struct Generation
+            {
+                uint64_t maxTick;
+                size_t numNodes;
+                // the retire lists taken by the GC pass
+                std::vector<DeletionFlag *> lists;
+            };
+            // a remover over the cap of pending nodes retries the GC pass at most this many times
+            static constexpr int CAP_RETRIES = 64;
+            RetireLists<DeletionFlag> retired;
+            // serializes the GC passes. The removers do not take it
+            std::mutex lock;
+            std::vector<Generation> generations;
+            std::atomic<size_t> generationNodes = {0};
+            // the deleter receives the queue, so that it can find the owner of the queue
+            typedef void (*Deleter)(DeletionQueue *, DeletionFlag *);
+            Deleter deleter;
+            // the stat counters of the map, including the retired and reclaimed nodes and the GC passes
+            StatRecorder statCounters;
+
+            size_t reclaimThreshold = 0;
+            size_t maxPending = 0;
+            std::thread reclaimer;
+            std::mutex reclaimerLock;
+            std::condition_variable reclaimerCv;
+            bool reclaimerRequested = false;
+            bool reclaimerStopped = false;
+
+            DeletionQueue(Deleter deleter) : deleter(deleter) {}
+            void enqueue(DeletionFlag *p)
+            {
+                // only the owner thread pushes to a list with a slot, but the GC pass may take the list at the same time
+                auto &list = retired.local();
+                DeletionFlag *oldHead = list.head.load(std::memory_order_relaxed);
+                do
+                {
+                    p->nextRetired = oldHead;
+                } while (!list.head.compare_exchange_weak(oldHead, p, std::memory_order_release, std::memory_order_relaxed));
+                list.count.fetch_add(1, std::memory_order_relaxed);
+                statCounters.count(StatCounters::NodesRetired);
+            }
+
+            // the approximate number of removed nodes which are not yet freed
+            size_t pending()
+            {
+                size_t ret = generationNodes.load(std::memory_order_relaxed);
+                for (auto &list : retired.all())
+                {
+                    ret += list.count.load(std::memory_order_relaxed);
+                }
+                return ret;
+            }
+
+            /**
+             * Called by the map after a removal, when the thread does not hold any locks or references to the nodes. Runs
+             * or requests a GC pass if the retire list of the thread reaches the threshold, and waits for the GC passes if
+             * the pending nodes exceed the cap
+             * */
+            void reclaimIfNeeded()
+            {
+                if (maxPending && pending() > maxPending)
+                {
+                    // the cap is best effort. A thread which does not update its clock can stop the GC from freeing nodes
+                    for (int i = 0; i < CAP_RETRIES && pending() > maxPending; i++)
+                    {
+                        doGC();
+                        std::this_thread::yield();
+                    }
+                    return;
+                }
+                if (!reclaimThreshold || retired.local().count.load(std::memory_order_relaxed) < reclaimThreshold)
+                {
+                    return;
+                }
+                if (reclaimer.joinable())
+                {
+                    std::lock_guard<std::mutex> guard(reclaimerLock);
+                    reclaimerRequested = true;
+                    reclaimerCv.notify_one();
+                    return;
+                }
+                updateLocalClock();
+                // if another thread is collecting the garbage, let it do the job
+                std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+                if (guard.owns_lock())
+                {
+                    collect();
+                }
+            }
+
+            void freeList(DeletionFlag *p)
+            {
+                while (p)
+                {
+                    auto next = p->nextRetired;
+                    deleter(this, p);
+                    p = next;
+                }
+            }
+
+            // the caller should hold the lock
+            void collect()
+            {
+                Generation gen;
+                gen.numNodes = 0;
+                for (auto &list : retired.all())
+                {
+                    if (list.head.load(std::memory_order_relaxed))
+                    {
+                        gen.numNodes += list.count.exchange(0, std::memory_order_relaxed);
+                        gen.lists.push_back(list.head.exchange(nullptr, std::memory_order_acquire));
+                    }
+                }
+                if (!gen.lists.empty())
+                {
+                    // the nodes taken are marked deleted before the clock is read
+                    gen.maxTick = GlobalClock::clock.logicalClock.load();
+                    generationNodes.fetch_add(gen.numNodes, std::memory_order_relaxed);
+                    generations.push_back(std::move(gen));
+                }
+                uint64_t epoch = GlobalClock::clock.update_safe_epoch();
+                statCounters.count(StatCounters::GCPasses);
+                size_t kept = 0;
+                for (auto &g : generations)
+                {
+                    if (g.maxTick <= epoch)
+                    {
+                        for (auto p : g.lists)
+                        {
+                            freeList(p);
+                        }
+                        generationNodes.fetch_sub(g.numNodes, std::memory_order_relaxed);
+                        statCounters.count(StatCounters::NodesReclaimed, g.numNodes);
+                    }
+                    else
+                    {
+                        if (&generations[kept] != &g)
+                        {
+                            generations[kept] = std::move(g);
+                        }
+                        kept++;
+                    }
+                }
+                generations.resize(kept);
+            }
+
+            void doGC()
+            {
+                updateLocalClock();
+                std::lock_guard<std::mutex> guard(lock);
+                collect();
+            }
+
+            /**
+             * Start a thread which runs a GC pass every (interval), or when a remover reaches the reclaim threshold
+             * */
+            void startReclaimer(std::chrono::milliseconds interval)
+            {
+                if (reclaimer.joinable())
+                {
+                    return;
+                }
+                reclaimerStopped = false;
+                reclaimer = std::thread([this, interval]() {
+                    std::unique_lock<std::mutex> guard(reclaimerLock);
+                    while (!reclaimerStopped)
+                    {
+                        reclaimerCv.wait_for(guard, interval, [this]() { return reclaimerRequested || reclaimerStopped; });
+                        reclaimerRequested = false;
+                        guard.unlock();
+                        doGC();
+                        // the reclaimer never reads the nodes. Keep it from holding back the safe epoch while it sleeps
+                        ThreadClock::tls_clock.logicalClock.store(std::numeric_limits<uint64_t>::max());
+                        guard.lock();
+                    }
+                });
+            }
+
+            void stopReclaimer()
+            {
+                if (!reclaimer.joinable())
+                {
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(reclaimerLock);
+                    reclaimerStopped = true;
+                    reclaimerCv.notify_one();
+                }
+                reclaimer.join();
+            }
+
+            // delete all nodes in the queue, no matter if they are ready to delete
+            void clear()
+            {
+                stopReclaimer();
+                for (auto &list : retired.all())
+                {
+                    freeList(list.head.exchange(nullptr));
+                    list.count.store(0);
+                }
+                for (auto &g : generations)
+                {
+                    for (auto p : g.lists)
+                    {
+                        freeList(p);
+                    }
+                }
+                generations.clear();
+                generationNodes.store(0);
+            }
+
+            ~DeletionQueue()
+            {
+                clear();
+            }
+        };
+    };
+
+    /**
+     * Protects the nodes with hazard pointers instead of the logical clocks. A reader publishes the node it is visiting, so
+     * a removed node can be freed once no thread publishes it, no matter if the other threads are idle. The removed but not
+     * freed nodes are bounded by the hazard pointers of all threads plus the retire lists. Each read of a node costs a
+     * full fence.
+     *
+     * The pointer returned by get() or setIfAbsent() stays valid until the thread calls the map again
+     * */
+    struct PolicyHazardPointer
+    {
+        static constexpr bool canRemove = true;
+        static constexpr bool usesHazardPointers = true;
+        template <typename T>
+        static T *protect(const std::atomic<T *> &src, unsigned slot)
+        {
+            return HazardRecord::tls_record.protect(src, slot);
+        }
+
+        // protect a node which is found or linked with the bucket locked, after the lock is released
+        static void pin(void *p)
+        {
+            HazardRecord::tls_record.hazards[2].store(p);
+        }
+
+        // called when the thread starts an operation on a map, releasing the node returned by the last operation
+        static void updateLocalClock()
+        {
+            HazardRecord::tls_record.clear();
+        }
+
+        struct DeletionFlag
+        {
+            std::atomic<bool> deleted = {false};
+            // links the removed nodes in the retire lists
+            DeletionFlag *nextRetired = nullptr;
+            void markDeleted()
+            {
+                deleted.store(true);
+            }
+
+            bool isDeleted()
+            {
+                return deleted.load();
+            }
+        };
+
+        /**
+         * Each thread pushes the removed nodes to its own retire list. When the list reaches (reclaimThreshold) nodes, the
+         * thread scans the hazard pointers of all threads and frees the nodes which are not published. The threshold should
+         * be larger than the number of the hazard pointers, so that a scan frees most of the list
+         * */
+        struct DeletionQueue
+        {
+            typedef RetireLists<DeletionFlag>::List RetireList;
+            static constexpr size_t DEFAULT_SCAN_THRESHOLD = 256;
+            RetireLists<DeletionFlag> retired;
+            typedef void (*Deleter)(DeletionQueue *, DeletionFlag *);
+            Deleter deleter;
+            // the stat counters of the map, including the retired and reclaimed nodes and the GC passes
+            StatRecorder statCounters;
+            size_t reclaimThreshold = DEFAULT_SCAN_THRESHOLD;
+            size_t maxPending = 0;
+
+            DeletionQueue(Deleter deleter) : deleter(deleter) {}
+
+            void push(RetireList &list, DeletionFlag *p)
+            {
+                DeletionFlag *oldHead = list.head.load(std::memory_order_relaxed);
+                do
+                {
+                    p->nextRetired = oldHead;
+                } while (!list.head.compare_exchange_weak(oldHead, p, std::memory_order_release, std::memory_order_relaxed));
+                list.count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void enqueue(DeletionFlag *p)
+            {
+                push(retired.local(), p);
+                statCounters.count(StatCounters::NodesRetired);
+            }
+
+            size_t pending()
+            {
+                size_t ret = 0;
+                for (auto &list : retired.all())
+                {
+                    ret += list.count.load(std::memory_order_relaxed);
+                }
+                return ret;
+            }
+
+            // called by the map after a removal, when the thread does not hold any locks
+            void reclaimIfNeeded()
+            {
+                auto &list = retired.local();
+                if (list.count.load(std::memory_order_relaxed) >= reclaimThreshold)
+                {
+                    std::vector<void *> hazards;
+                    HazardRegistry::registry.snapshot(hazards);
+                    scan(list, hazards);
+                    statCounters.count(StatCounters::GCPasses);
+                }
+                else if (maxPending && pending() > maxPending)
+                {
+                    doGC();
+                }
+            }
+
+            // take the list, free the nodes which are not in (hazards) and push the others back to the list of the thread
+            void scan(RetireList &list, const std::vector<void *> &hazards)
+            {
+                list.count.exchange(0, std::memory_order_relaxed);
+                DeletionFlag *p = list.head.exchange(nullptr, std::memory_order_acquire);
+                auto &mine = retired.local();
+                uint64_t freed = 0;
+                while (p)
+                {
+                    auto next = p->nextRetired;
+                    if (std::binary_search(hazards.begin(), hazards.end(), (void *)p))
+                    {
+                        push(mine, p);
+                    }
+                    else
+                    {
+                        deleter(this, p);
+                        freed++;
+                    }
+                    p = next;
+                }
+                statCounters.count(StatCounters::NodesReclaimed, freed);
+            }
+
+            void doGC()
+            {
+                updateLocalClock();
+                std::vector<void *> hazards;
+                HazardRegistry::registry.snapshot(hazards);
+                for (auto &list : retired.all())
+                {
+                    if (list.head.load(std::memory_order_relaxed))
+                    {
+                        scan(list, hazards);
+                    }
+                }
+                statCounters.count(StatCounters::GCPasses);
+            }
+
+            // delete all nodes in the queue, no matter if they are published
+            void clear()
+            {
+                for (auto &list : retired.all())
+                {
+                    DeletionFlag *p = list.head.exchange(nullptr);
+                    list.count.store(0);
+                    while (p)
+                    {
+                        auto next = p->nextRetired;
+                        deleter(this, p);
+                        p = next;
+                    }
+                }
+            }
+
+            ~DeletionQueue()
+            {
+                clear();
+            }
+        };
+    };
+} // namespace Kuai
@@ -1,218 +1,1225 @@
 #pragma once
 #include "SpinLock.hpp"
 #include "ListNode.hpp"
-#include "LogicalClock.hpp"
+#include "BucketPolicy.hpp"
+#include "MemoryPool.hpp"
+#include "Hash.hpp"
+#include "BucketLayout.hpp"
+#include "Snapshot.hpp"
+#include "FrozenMap.hpp"
+#include "Stats.hpp"
 #include <stdint.h>
 #include <utility>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace Kuai
 {
 
-    struct PolicyNoRemove
+    template <typename BucketPolicy, typename K, typename V, typename Hasher = std::hash<K>, typename Comparer = std::equal_to<K>,
+              typename Allocator = HeapAllocator, typename HashMixer = typename DefaultMixer<Hasher>::type,
+              typename BucketLayout = LayoutInlineLock, typename LockType = SpinLock>
+    struct ConHashMap : private BucketPolicy::DeletionQueue
     {
-        static void updateLocalClock()
+        struct HashListNode : public BucketPolicy::DeletionFlag
+        {
+            // the hash of the key. It is compared before the keys, and saves rehashing the keys when splitting buckets
+            uint64_t hashv;
+            K k;
+            V v;
+            std::atomic<HashListNode *> next;
+
+            // construct the key and the value in place
+            template <typename KType, typename... Args>
+            HashListNode(uint64_t hashv, KType &&k, Args &&... args)
+                : hashv(hashv), k(std::forward<KType>(k)), v(std::forward<Args>(args)...), next(nullptr)
+            {
+            }
+        };
+
+        typedef typename BucketLayout::template Layout<LockType> LayoutType;
+
+        struct Bucket : public LayoutType::BucketBase
+        {
+            std::atomic<HashListNode *> ptr = {nullptr};
+        };
+
+        static constexpr unsigned MAX_SEGMENTS = 64;
+        static constexpr unsigned COUNTER_STRIPES = 16;
+        // the load factor is checked once every (LOAD_CHECK_INTERVAL) insertions on a counter stripe
+        static constexpr int64_t LOAD_CHECK_INTERVAL = 64;
+        // the number of keys prefetched together in getBatch and setBatch
+        static constexpr size_t PREFETCH_BATCH = 16;
+        // the number of buckets taken at a time by the threads of parallelForEach
+        static constexpr size_t FOREACH_RANGE = 1024;
+
+        struct alignas(64) Counter
+        {
+            std::atomic<int64_t> v = {0};
+        };
+
+        struct alignas(64) InsertFlag
+        {
+            std::atomic<uint32_t> v = {0};
+        };
+
+        // enables the lookups by the keys of type KeyLike other than K
+        template <typename KeyLike>
+        struct isTransparent
+            : std::integral_constant<bool, IsTransparent<Hasher>::value && IsTransparent<Comparer>::value &&
+                                               !std::is_same<KeyLike, K>::value>
+        {
+        };
+
+        /**
+         * The map grows by linear hashing. When the load factor is exceeded, the buckets are split one by one in order. The
+         * bucket array is split into segments which never move. Segment 0 holds the first (1 << initialBits) buckets and
+         * segment s (s>0) holds the buckets in [1 << (initialBits + s - 1), 1 << (initialBits + s))
+         * */
+        std::atomic<Bucket *> segments[MAX_SEGMENTS];
+        unsigned initialBits;
+        size_t initialSize;
+        // The number of buckets in use and the mask of hash bits to index the buckets. (levelMask + 1) / 2 <= bucketNum <=
+        // levelMask + 1. The buckets which index >= bucketNum are not yet split from bucket (index - (levelMask + 1) / 2)
+        std::atomic<size_t> bucketNum;
+        std::atomic<size_t> levelMask;
+        float maxLoadFactor = 1.0f;
+        std::mutex resizeLock;
+        Counter counters[COUNTER_STRIPES];
+        Hasher hasher;
+        Comparer cmper;
+        // the allocator of HashListNode
+        Allocator allocator;
+        static_assert(alignof(HashListNode) <= AllocatorAlignment<Allocator>::value,
+                      "The allocator does not align the nodes enough for K and V. Use HeapAllocator for over-aligned types");
+        // holds the locks and the split sequence numbers of the buckets
+        LayoutType layout;
+        /**
+         * The inserters which do not lock the buckets, indexed by ThreadSlot. The threads without a slot share the last
+         * flag. The buckets are only split when (splitting) is set and all flags are cleared, so the inserters holding the
+         * flags see no split. It is allocated by setLockFreeInsert(true), so the maps with locked inserts do not pay for it
+         * */
+        InsertFlag *inserting = nullptr;
+        std::atomic<bool> splitting = {false};
+        // the number of the running iterations. The buckets are not split when it is not zero
+        std::atomic<int> scanners = {0};
+        bool lockFreeInsert = false;
+
+    private:
+        template <typename KeyLike>
+        uint64_t hashOf(const KeyLike &k)
+        {
+            return HashMixer::mix(hasher(k));
+        }
+
+        static unsigned highestBit(uint64_t v)
+        {
+            return 63 - __builtin_clzll(v);
+        }
+
+        static size_t bucketIndex(uint64_t hashv, size_t mask, size_t num)
+        {
+            size_t idx = hashv & mask;
+            return idx < num ? idx : idx & (mask >> 1);
+        }
+
+        // levelMask should be loaded before bucketNum. See splitBucket()
+        size_t bucketIndex(uint64_t hashv)
+        {
+            size_t mask = levelMask.load(std::memory_order_acquire);
+            return bucketIndex(hashv, mask, bucketNum.load(std::memory_order_acquire));
+        }
+
+        Bucket &bucketAt(size_t idx)
+        {
+            if (idx < initialSize)
+            {
+                return segments[0].load(std::memory_order_relaxed)[idx];
+            }
+            unsigned hibit = highestBit(idx);
+            return segments[hibit - initialBits + 1].load(std::memory_order_relaxed)[idx - (size_t(1) << hibit)];
+        }
+
+        // lock the bucket of the key and return the lock in (lock). The key will not be moved to other buckets when we hold
+        // the lock
+        Bucket &lockBucket(uint64_t hashv, LockType *&lock)
+        {
+            for (;;)
+            {
+                size_t mask = levelMask.load(std::memory_order_acquire);
+                size_t num = bucketNum.load(std::memory_order_acquire);
+                size_t idx = bucketIndex(hashv, mask, num);
+                Bucket &buck = bucketAt(idx);
+                lock = &layout.lockOf(buck, idx);
+                this->statCounters.countLock(lockWithSpins(*lock));
+                // splitting a bucket needs its lock, so the bucket is not split if bucketNum is not changed
+                if (bucketNum.load(std::memory_order_acquire) == num || bucketIndex(hashv) == idx)
+                {
+                    return buck;
+                }
+                // the bucket has been split and the key is moved
+                lock->unlock();
+            }
+        }
+
+        // make a node with the key and the value constructed from (args). With no args, the value is value-initialized
+        template <typename KType, typename... Args>
+        HashListNode *makeNewNode(uint64_t hashv, KType &&k, Args &&... args)
+        {
+            void *mem = allocator.alloc();
+            try
+            {
+                return new (mem) HashListNode(hashv, std::forward<KType>(k), std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                allocator.dealloc(mem);
+                throw;
+            }
+        }
+
+        // assign the value from a single argument which V can be assigned from
+        template <typename VType>
+        static typename std::enable_if<std::is_assignable<V &, VType &&>::value>::type assignValue(V &dst, VType &&v)
+        {
+            dst = std::forward<VType>(v);
+        }
+
+        // otherwise construct a temporary value from the args and move it
+        template <typename... Args>
+        static void assignValue(V &dst, Args &&... args)
+        {
+            dst = V(std::forward<Args>(args)...);
+        }
+
+        // find the node in a bucket. The caller should hold the lock of the bucket. The loads acquire the nodes, since the
+        // lock-free inserters link them without the lock
+        template <typename KeyLike>
+        HashListNode *findNode(Bucket &buck, uint64_t hashv, const KeyLike &k, HashListNode *&prevNode)
+        {
+            prevNode = nullptr;
+            HashListNode *headNode = buck.ptr.load(std::memory_order_acquire);
+            while (headNode)
+            {
+                if (headNode->hashv == hashv && cmper(headNode->k, k))
+                {
+                    return headNode;
+                }
+                prevNode = headNode;
+                headNode = headNode->next.load(std::memory_order_acquire);
+            }
+            return nullptr;
+        }
+
+        /**
+         * Search the key in the list from (headNode), which is protected in hazard slot (slot). Returns false if a removed
+         * node is met, and the search should be restarted from the bucket. Otherwise (found) is set to the node of the key,
+         * or nullptr
+         * */
+        template <typename KeyLike>
+        bool searchList(HashListNode *headNode, unsigned slot, uint64_t hashv, const KeyLike &k, HashListNode *&found)
+        {
+            while (headNode)
+            {
+                if (headNode->isDeleted())
+                {
+                    return false;
+                }
+                if (headNode->hashv == hashv && cmper(headNode->k, k))
+                {
+                    found = headNode;
+                    return true;
+                }
+                slot = slot == 1 ? 0 : 1;
+                HashListNode *next = BucketPolicy::protect(headNode->next, slot);
+                // with hazard pointers, the next node may have been freed if the current node is removed
+                if (BucketPolicy::usesHazardPointers && next && headNode->isDeleted())
+                {
+                    return false;
+                }
+                headNode = next;
+            }
+            found = nullptr;
+            return true;
+        }
+
+        template <typename KeyLike>
+        HashListNode *findNode(uint64_t hashv, const KeyLike &k)
+        {
+            for (;;)
+            {
+                size_t mask = levelMask.load(std::memory_order_acquire);
+                size_t num = bucketNum.load(std::memory_order_acquire);
+                size_t idx = bucketIndex(hashv, mask, num);
+                Bucket &buck = bucketAt(idx);
+                std::atomic<uint32_t> &splitSeq = layout.splitSeqOf(buck, idx);
+                uint32_t seq = splitSeq.load(std::memory_order_acquire);
+                HashListNode *found;
+                // reload head node if we met a deleted node
+                if (!searchList(BucketPolicy::protect(buck.ptr, 0), 0, hashv, k, found))
+                {
+                    this->statCounters.count(StatCounters::FindRetries);
+                    continue;
+                }
+                if (found)
+                    return found;
+                // if the key is not found, make sure the bucket is not split while we are reading it
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (!(seq & 1) && splitSeq.load(std::memory_order_relaxed) == seq && bucketNum.load(std::memory_order_relaxed) == num)
+                    return nullptr;
+                this->statCounters.count(StatCounters::SplitRetries);
+            }
+        }
+
+        /**
+         * Link a new node of the key at the head of the bucket if the key is not in the bucket, and return nullptr.
+         * Otherwise return the node of the key. The new node is made by (makeNode) only when it is needed. If it is made
+         * but not linked, it is returned in (spare) and the caller should free it.
+         *
+         * The lock-free inserters and the removers may change the head at the same time, so the head is updated by CAS and
+         * the bucket is searched again if it fails. The caller should either hold the lock of the bucket or an insert flag
+         * */
+        template <typename KeyLike, typename MakeNode>
+        HashListNode *linkIfAbsent(Bucket &buck, uint64_t hashv, const KeyLike &k, HashListNode *&spare, MakeNode &&makeNode)
+        {
+            spare = nullptr;
+            for (;;)
+            {
+                // hazard slot 2 keeps the head from being freed and reused before the CAS
+                HashListNode *head = BucketPolicy::protect(buck.ptr, 2);
+                HashListNode *found;
+                // the key may have been moved into the spare node
+                bool ok = spare ? searchList(head, 2, hashv, spare->k, found) : searchList(head, 2, hashv, k, found);
+                if (!ok)
+                    continue;
+                if (found)
+                    return found;
+                if (!spare)
+                {
+                    spare = makeNode();
+                }
+                spare->next.store(head, std::memory_order_relaxed);
+                if (buck.ptr.compare_exchange_strong(head, spare, std::memory_order_release, std::memory_order_relaxed))
+                {
+                    spare = nullptr;
+                    return nullptr;
+                }
+            }
+        }
+
+        // set the insert flag of the thread and find the bucket of the key. Returns nullptr if the buckets are being split
+        Bucket *beginLockFreeInsert(uint64_t hashv)
+        {
+            auto &flag = inserting[ThreadSlot::tls_slot.id].v;
+            // orders the flag before loading (splitting), pairing with growTo()
+            flag.fetch_add(1);
+            if (splitting.load())
+            {
+                flag.fetch_sub(1, std::memory_order_release);
+                return nullptr;
+            }
+            return &bucketAt(bucketIndex(hashv));
+        }
+
+        void endLockFreeInsert()
+        {
+            inserting[ThreadSlot::tls_slot.id].v.fetch_sub(1, std::memory_order_release);
+        }
+
+        // stops the splits during an iteration. The running growTo() stops at the next split, and the resizeLock is taken
+        // to wait for it. The lock is not held during the iteration, so the iterating threads can write to the map
+        struct ScanGuard
+        {
+            ConHashMap &map;
+            ScanGuard(ConHashMap &map) : map(map)
+            {
+                map.scanners.fetch_add(1);
+                std::lock_guard<std::mutex> guard(map.resizeLock);
+            }
+            ScanGuard(const ScanGuard &) = delete;
+            ~ScanGuard()
+            {
+                map.scanners.fetch_sub(1, std::memory_order_release);
+            }
+        };
+
+        void addCount(uint64_t hashv, int64_t delta)
+        {
+            auto cnt = counters[hashv % COUNTER_STRIPES].v.fetch_add(delta, std::memory_order_relaxed) + delta;
+            if (delta > 0 && cnt % LOAD_CHECK_INTERVAL == 0)
+            {
+                checkLoadFactor();
+            }
+        }
+
+        void checkLoadFactor()
+        {
+            if (size() > maxLoadFactor * bucketNum.load(std::memory_order_relaxed))
+            {
+                // if another thread is growing the map, let it do the job
+                std::unique_lock<std::mutex> guard(resizeLock, std::try_to_lock);
+                if (guard.owns_lock())
+                {
+                    growTo(size_t(size() / maxLoadFactor));
+                }
+            }
+        }
+
+        // move the keys of bucket (num - base) to the new bucket (num) by the next bit of hash. The caller should hold the
+        // resizeLock
+        void splitBucket()
+        {
+            size_t num = bucketNum.load(std::memory_order_relaxed);
+            size_t mask = levelMask.load(std::memory_order_relaxed);
+            if (num == mask + 1)
+            {
+                // all buckets have been split, start a new level
+                unsigned seg = highestBit(num) - initialBits + 1;
+                if (seg >= MAX_SEGMENTS)
+                {
+                    return;
+                }
+                segments[seg].store(new Bucket[num], std::memory_order_relaxed);
+                // Indexing with one more bit of hash gives the same buckets before the next split, so readers can load
+                // any combination of the old/new levelMask and bucketNum
+                mask = mask * 2 + 1;
+                levelMask.store(mask, std::memory_order_release);
+            }
+            size_t base = (mask + 1) / 2;
+            Bucket &src = bucketAt(num - base);
+            Bucket &dst = bucketAt(num);
+            std::atomic<uint32_t> &splitSeq = layout.splitSeqOf(src, num - base);
+            LockType &lock = layout.lockOf(src, num - base);
+            this->statCounters.countLock(lockWithSpins(lock));
+            std::lock_guard<LockType> guard(lock, std::adopt_lock);
+            uint32_t seq = splitSeq.load(std::memory_order_relaxed);
+            splitSeq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            // Relink the nodes into two lists keeping their order. A node will only be linked to the nodes after it, so
+            // concurrent readers will not loop in the list
+            HashListNode *heads[2] = {nullptr, nullptr};
+            HashListNode *tails[2] = {nullptr, nullptr};
+            for (HashListNode *cur = src.ptr.load(std::memory_order_relaxed); cur; cur = cur->next.load(std::memory_order_relaxed))
+            {
+                int side = (cur->hashv & base) ? 1 : 0;
+                if (tails[side])
+                {
+                    tails[side]->next.store(cur, std::memory_order_release);
+                }
+                else
+                {
+                    heads[side] = cur;
+                }
+                tails[side] = cur;
+            }
+            for (int side = 0; side < 2; side++)
+            {
+                if (tails[side])
+                {
+                    tails[side]->next.store(nullptr, std::memory_order_release);
+                }
+            }
+            dst.ptr.store(heads[1], std::memory_order_release);
+            src.ptr.store(heads[0], std::memory_order_release);
+            bucketNum.store(num + 1, std::memory_order_release);
+            splitSeq.store(seq + 2, std::memory_order_release);
+        }
+
+        // The caller should hold the resizeLock. The map is not grown while there are iterations, and it will grow at the
+        // inserts after they finish
+        void growTo(size_t numBuckets)
+        {
+            size_t num = bucketNum.load(std::memory_order_relaxed);
+            if (num >= numBuckets || scanners.load())
+            {
+                return;
+            }
+            if (lockFreeInsert)
+            {
+                // stop the lock-free inserters, and wait for the running ones
+                splitting.store(true);
+                for (size_t i = 0; i <= ThreadSlot::MAX_SLOTS; i++)
+                {
+                    while (inserting[i].v.load())
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            while (num < numBuckets && !scanners.load())
+            {
+                splitBucket();
+                size_t newNum = bucketNum.load(std::memory_order_relaxed);
+                if (newNum == num)
+                {
+                    break;
+                }
+                num = newNum;
+            }
+            splitting.store(false, std::memory_order_release);
+        }
+
+        // set the value constructed from (args) with the bucket locked. Returns true if the key is inserted
+        template <typename KType, typename... Args>
+        bool lockedEmplace(uint64_t hashv, KType &&k, Args &&... args)
+        {
+            LockType *lock;
+            Bucket &buck = lockBucket(hashv, lock);
+            std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+            HashListNode *spare;
+            HashListNode *cur = linkIfAbsent(buck, hashv, k, spare, [&]() {
+                return makeNewNode(hashv, std::forward<KType>(k), std::forward<Args>(args)...);
+            });
+            if (!cur)
+            {
+                return true;
+            }
+            // the key is inserted by a lock-free inserter after the value is moved to the spare node
+            if (spare)
+            {
+                cur->v = std::move(spare->v);
+                freeNode(spare);
+            }
+            else
+            {
+                assignValue(cur->v, std::forward<Args>(args)...);
+            }
+            return false;
+        }
+
+        template <typename KType, typename... Args>
+        void emplaceWithHash(uint64_t hashv, KType &&k, Args &&... args)
+        {
+            bool inserted;
+            // updating the value of an existing key needs the lock
+            Bucket *buck = lockFreeInsert && !findNode(hashv, k) ? beginLockFreeInsert(hashv) : nullptr;
+            if (buck)
+            {
+                HashListNode *spare;
+                HashListNode *cur = linkIfAbsent(*buck, hashv, k, spare, [&]() {
+                    return makeNewNode(hashv, std::forward<KType>(k), std::forward<Args>(args)...);
+                });
+                endLockFreeInsert();
+                if (!cur)
+                {
+                    inserted = true;
+                }
+                else if (spare)
+                {
+                    // the key is inserted by another thread after the key and the value are moved to the spare node
+                    inserted = lockedEmplace(hashv, std::move(spare->k), std::move(spare->v));
+                    freeNode(spare);
+                }
+                else
+                {
+                    inserted = lockedEmplace(hashv, std::forward<KType>(k), std::forward<Args>(args)...);
+                }
+            }
+            else
+            {
+                inserted = lockedEmplace(hashv, std::forward<KType>(k), std::forward<Args>(args)...);
+            }
+            if (inserted)
+            {
+                addCount(hashv, 1);
+            }
+        }
+
+        // insert the value constructed from (args) if the key is not found. Returns the existing value, or nullptr
+        template <typename KType, typename... Args>
+        V *tryEmplaceWithHash(uint64_t hashv, KType &&k, Args &&... args)
+        {
+            HashListNode *spare;
+            HashListNode *cur;
+            auto makeNode = [&]() { return makeNewNode(hashv, std::forward<KType>(k), std::forward<Args>(args)...); };
+            Bucket *buck = nullptr;
+            if (lockFreeInsert)
+            {
+                cur = findNode(hashv, k);
+                if (cur)
+                {
+                    return &cur->v;
+                }
+                buck = beginLockFreeInsert(hashv);
+            }
+            if (buck)
+            {
+                cur = linkIfAbsent(*buck, hashv, k, spare, makeNode);
+                endLockFreeInsert();
+            }
+            else
+            {
+                LockType *lock;
+                Bucket &lockedBuck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                cur = linkIfAbsent(lockedBuck, hashv, k, spare, makeNode);
+            }
+            if (spare)
+            {
+                // the spare node is never seen by other threads
+                freeNode(spare);
+            }
+            if (cur)
+            {
+                // the node is protected by the hazard pointers of linkIfAbsent, or the local clock
+                return &cur->v;
+            }
+            addCount(hashv, 1);
+            return nullptr;
+        }
+
+        // remove the key. Only used by the maps which can remove
+        template <typename KeyLike>
+        void removeKey(const KeyLike &k)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            {
+                LockType *lock;
+                Bucket &buck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                HashListNode *prevNode;
+                HashListNode *cur;
+                for (;;)
+                {
+                    cur = findNode(buck, hashv, k, prevNode);
+                    if (!cur)
+                    {
+                        throw std::runtime_error("Cannot find the key!");
+                    }
+                    if (prevNode)
+                    {
+                        prevNode->next.store(cur->next.load(std::memory_order_relaxed), std::memory_order_release);
+                        break;
+                    }
+                    HashListNode *expected = cur;
+                    if (buck.ptr.compare_exchange_strong(expected, cur->next.load(std::memory_order_relaxed), std::memory_order_release,
+                                                         std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                    // the lock-free inserters have linked new nodes before the node. Find its previous node again
+                }
+                cur->markDeleted();
+                this->enqueue(cur);
+            }
+            addCount(hashv, -1);
+            // the GC pass frees the nodes, so it should be run out of the bucket lock
+            this->reclaimIfNeeded();
+        }
+
+        static SnapshotHeader snapshotHeader()
+        {
+            SnapshotHeader header;
+            memcpy(header.magic, SnapshotHeader::expectedMagic(), sizeof(header.magic));
+            header.version = SnapshotHeader::VERSION;
+            header.keySize = SnapshotSerializer<K>::fixedSize ? sizeof(K) : 0;
+            header.valueSize = SnapshotSerializer<V>::fixedSize ? sizeof(V) : 0;
+            header.reserved = 0;
+            header.count = 0;
+            return header;
+        }
+
+        // the fixed-sized records are inserted from the mapped file
+        void loadRecords(const char *p, const char *end, uint64_t count, unsigned numThreads, std::true_type)
+        {
+            typedef SnapshotRecordIterator<K, V> RecordIterator;
+            if (count > uint64_t(end - p) / RecordIterator::RECORD_SIZE)
+            {
+                throw std::runtime_error("The snapshot is truncated");
+            }
+            bulkInsert(RecordIterator{p}, RecordIterator{p + count * RecordIterator::RECORD_SIZE}, numThreads);
+        }
+
+        // otherwise the records are decoded first
+        void loadRecords(const char *p, const char *end, uint64_t count, unsigned numThreads, std::false_type)
+        {
+            std::vector<std::pair<K, V>> items;
+            // a record takes at least a byte
+            items.reserve(count < uint64_t(end - p) ? count : uint64_t(end - p));
+            for (uint64_t i = 0; i < count; i++)
+            {
+                K k = SnapshotSerializer<K>::read(p, end);
+                items.emplace_back(std::move(k), SnapshotSerializer<V>::read(p, end));
+            }
+            bulkInsert(items.begin(), items.end(), numThreads);
+        }
+
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove, size_t>::type pendingOrZero()
+        {
+            return this->pending();
+        }
+
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<!Dummy::canRemove, size_t>::type pendingOrZero()
+        {
+            return 0;
+        }
+
+        // run fn(tid) for tid in [0, numThreads), with tid 0 on the calling thread
+        template <typename Fn>
+        static void runThreads(unsigned numThreads, Fn &&fn)
+        {
+            std::vector<std::thread> threads;
+            for (unsigned i = 1; i < numThreads; i++)
+            {
+                threads.emplace_back(fn, i);
+            }
+            fn(0);
+            for (auto &th : threads)
+            {
+                th.join();
+            }
+        }
+
+        // find the key in the nodes from (from) until (to)
+        HashListNode *findBetween(HashListNode *from, HashListNode *to, uint64_t hashv, const K &k)
+        {
+            for (HashListNode *cur = from; cur != to; cur = cur->next.load(std::memory_order_acquire))
+            {
+                if (cur->hashv == hashv && cmper(cur->k, k))
+                {
+                    return cur;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+         * Link the private list of new nodes from (chain) to (tail) at the head of a bucket by a single CAS. The values of
+         * the keys already in the bucket are replaced and their new nodes are freed. Returns the number of inserted keys
+         * */
+        int64_t publishChain(size_t idx, HashListNode *chain, HashListNode *tail)
+        {
+            Bucket &buck = bucketAt(idx);
+            LockType &lock = layout.lockOf(buck, idx);
+            this->statCounters.countLock(lockWithSpins(lock));
+            std::lock_guard<LockType> guard(lock, std::adopt_lock);
+            HashListNode *head = buck.ptr.load(std::memory_order_acquire);
+            // the nodes from (checked) on have been compared with the new nodes
+            HashListNode *checked = nullptr;
+            for (;;)
+            {
+                HashListNode *kept = nullptr;
+                int64_t count = 0;
+                for (HashListNode *cur = chain, *next; cur; cur = next)
+                {
+                    next = cur->next.load(std::memory_order_relaxed);
+                    HashListNode *found = findBetween(head, checked, cur->hashv, cur->k);
+                    if (found)
+                    {
+                        found->v = std::move(cur->v);
+                        freeNode(cur);
+                        continue;
+                    }
+                    if (!kept)
+                    {
+                        tail = cur;
+                    }
+                    cur->next.store(kept, std::memory_order_relaxed);
+                    kept = cur;
+                    count++;
+                }
+                chain = kept;
+                if (!chain)
+                {
+                    return 0;
+                }
+                tail->next.store(head, std::memory_order_relaxed);
+                HashListNode *expected = head;
+                if (buck.ptr.compare_exchange_strong(expected, chain, std::memory_order_release, std::memory_order_acquire))
+                {
+                    return count;
+                }
+                // the lock-free inserters have linked new nodes. Only they should be compared again
+                tail->next.store(nullptr, std::memory_order_relaxed);
+                checked = head;
+                head = expected;
+            }
+        }
+
+        /**
+         * Insert the items (first[items[0]], ..., first[items[cnt - 1]]) of a bulk insert, which are in the buckets only
+         * owned by this thread. The items are grouped by bucket with a counting sort, keeping their order in the input, and
+         * the nodes of each bucket are published together
+         * */
+        template <typename Iter>
+        void bulkInsertOwned(Iter first, const uint64_t *hashes, const size_t *items, size_t cnt, size_t mask, size_t num,
+                             unsigned tid)
+        {
+            if (!cnt)
+            {
+                return;
+            }
+            size_t minIdx = num, maxIdx = 0;
+            for (size_t j = 0; j < cnt; j++)
+            {
+                size_t idx = bucketIndex(hashes[items[j]], mask, num);
+                minIdx = idx < minIdx ? idx : minIdx;
+                maxIdx = idx > maxIdx ? idx : maxIdx;
+            }
+            std::vector<size_t> pos(maxIdx - minIdx + 2);
+            for (size_t j = 0; j < cnt; j++)
+            {
+                pos[bucketIndex(hashes[items[j]], mask, num) - minIdx + 1]++;
+            }
+            for (size_t b = 1; b < pos.size(); b++)
+            {
+                pos[b] += pos[b - 1];
+            }
+            std::vector<size_t> sorted(cnt);
+            for (size_t j = 0; j < cnt; j++)
+            {
+                sorted[pos[bucketIndex(hashes[items[j]], mask, num) - minIdx]++] = items[j];
+            }
+            int64_t inserted = 0;
+            for (size_t j = 0; j < cnt;)
+            {
+                size_t idx = bucketIndex(hashes[sorted[j]], mask, num);
+                HashListNode *chain = nullptr;
+                HashListNode *tail = nullptr;
+                for (; j < cnt && bucketIndex(hashes[sorted[j]], mask, num) == idx; j++)
+                {
+                    size_t i = sorted[j];
+                    // the later item of the same key wins, like set()
+                    HashListNode *dup = findBetween(chain, nullptr, hashes[i], first[i].first);
+                    if (dup)
+                    {
+                        dup->v = first[i].second;
+                        continue;
+                    }
+                    HashListNode *node = makeNewNode(hashes[i], first[i].first, first[i].second);
+                    node->next.store(chain, std::memory_order_relaxed);
+                    chain = node;
+                    tail = tail ? tail : node;
+                }
+                inserted += publishChain(idx, chain, tail);
+            }
+            counters[tid % COUNTER_STRIPES].v.fetch_add(inserted, std::memory_order_relaxed);
+        }
+
+        // hash the keys, and prefetch their buckets and then the head nodes of the buckets
+        void prefetchKeys(const K *keys, size_t n, uint64_t *hashes, bool forWrite)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                hashes[i] = hashOf(keys[i]);
+                Bucket *buck = &bucketAt(bucketIndex(hashes[i]));
+                if (forWrite)
+                {
+                    __builtin_prefetch(buck, 1);
+                }
+                else
+                {
+                    __builtin_prefetch(buck);
+                }
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                __builtin_prefetch(bucketAt(bucketIndex(hashes[i])).ptr.load(std::memory_order_relaxed));
+            }
+        }
+
+        void freeNode(HashListNode *node)
+        {
+            node->~HashListNode();
+            allocator.dealloc(node);
+        }
+
+        static void nodeDeleter(typename BucketPolicy::DeletionQueue *queue, typename BucketPolicy::DeletionFlag *node)
         {
+            static_cast<ConHashMap *>(queue)->freeNode(static_cast<HashListNode *>(node));
         }
-        struct DeletionFlag
+
+    public:
+        /**
+         * Create the map with the initial bucket number, which is rounded up to a power of 2. (numLockStripes) is the number
+         * of bucket locks for LayoutStripedLock. 0 means 16 stripes per hardware thread
+         * */
+        ConHashMap(size_t numBuckets, size_t numLockStripes = 0)
+            : BucketPolicy::DeletionQueue(nodeDeleter), allocator(sizeof(HashListNode)), layout(numLockStripes)
         {
-            constexpr bool isDeleted()
+            initialBits = numBuckets > 1 ? highestBit(numBuckets - 1) + 1 : 0;
+            initialSize = size_t(1) << initialBits;
+            for (auto &seg : segments)
             {
-                return false;
+                seg.store(nullptr, std::memory_order_relaxed);
             }
-        };
-        struct DeletionQueue
+            segments[0].store(new Bucket[initialSize], std::memory_order_relaxed);
+            levelMask.store(initialSize - 1, std::memory_order_relaxed);
+            bucketNum.store(initialSize, std::memory_order_release);
+        }
+
+        // make the map from the pairs in [first, last) by bulkInsert()
+        template <typename Iter>
+        ConHashMap(Iter first, Iter last, size_t numBuckets, unsigned numThreads = std::thread::hardware_concurrency())
+            : ConHashMap(numBuckets)
         {
-            typedef void (*Deleter)(DeletionFlag *);
-            DeletionQueue(Deleter v) {}
-        };
-        static constexpr bool canRemove = false;
-    };
+            bulkInsert(first, last, numThreads);
+        }
 
-    struct PolicyCanRemove
-    {
-        static constexpr bool canRemove = true;
-        static void updateLocalClock()
+        ~ConHashMap()
         {
-            // sync local clock with global clock, indicating this core has seen the events with logical tick
-            // less than the current global clock
-            ThreadClock::updateLocalClock();
+            // the removed nodes should be freed before the allocator is destroyed. It also stops the background reclaimer
+            this->clear();
+            size_t num = bucketNum.load();
+            for (size_t i = 0; i < num; i++)
+            {
+                HashListNode *cur = bucketAt(i).ptr;
+                while (cur)
+                {
+                    auto next = cur->next.load();
+                    freeNode(cur);
+                    cur = next;
+                }
+            }
+            for (auto &seg : segments)
+            {
+                delete[] seg.load();
+            }
+            free(inserting);
         }
 
-        struct DeletionFlag
+        /**
+         * Get the approximate number of key-value pairs in the map
+         * */
+        size_t size()
         {
-            std::atomic<uint64_t> deleteTick = {0};
-            void markDeleted()
+            int64_t ret = 0;
+            for (auto &c : counters)
             {
-                // push up the global clock, indicating there is a new event that may not be seen by other cores
-                auto clockv = ++GlobalClock::clock.logicalClock;
-                deleteTick.store(clockv);
-                // update the clock for the current thread because we have already seen it
-                ThreadClock::tls_clock.logicalClock.store(clockv, std::memory_order::memory_order_relaxed);
+                ret += c.v.load(std::memory_order_relaxed);
+            }
+            return ret > 0 ? ret : 0;
+        }
+
+        size_t bucketCount()
+        {
+            return bucketNum.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Set the max average number of key-value pairs per bucket. When it is exceeded, the map will split the buckets
+         * until the load factor is satisfied. Should be called before the map is shared with other threads
+         * */
+        void setMaxLoadFactor(float f)
+        {
+            maxLoadFactor = f;
+        }
 
+        /**
+         * Let set() and setIfAbsent() link the new nodes by CAS on the bucket heads without locking the buckets. The
+         * buckets are still locked to update the values of the existing keys and to remove the keys. Should be called
+         * before the map is shared with other threads
+         * */
+        void setLockFreeInsert(bool enabled)
+        {
+            if (enabled && !inserting)
+            {
+                // new does not respect the alignment of InsertFlag in C++11
+                void *mem = nullptr;
+                if (posix_memalign(&mem, 64, (ThreadSlot::MAX_SLOTS + 1) * sizeof(InsertFlag)))
+                {
+                    throw std::bad_alloc();
+                }
+                inserting = (InsertFlag *)mem;
+                for (size_t i = 0; i <= ThreadSlot::MAX_SLOTS; i++)
+                {
+                    new (inserting + i) InsertFlag();
+                }
             }
+            lockFreeInsert = enabled;
+        }
+
+        /**
+         * Grow the bucket number so that the map can hold numElements pairs without exceeding the max load factor
+         * */
+        void reserve(size_t numElements)
+        {
+            std::lock_guard<std::mutex> guard(resizeLock);
+            growTo(size_t(numElements / maxLoadFactor));
+        }
 
-            bool readyToDelete()
+        /**
+         * A read section of the current thread on the map. The local clock is published when the guard is created and
+         * when it is destroyed, and the get() calls of the guard skip the per-call clock update. The pointers returned in
+         * the section stay valid until the guard is destroyed, even if the keys are removed by other threads. A thread in a
+         * read section holds back the freeing of the removed nodes of all maps, so the section should be short. The
+         * sections can be nested. Not supported by PolicyHazardPointer
+         * */
+        struct ReadGuard
+        {
+            static_assert(!BucketPolicy::usesHazardPointers, "PolicyHazardPointer protects one returned node per thread");
+            ConHashMap &map;
+            ReadGuard(ConHashMap &map) : map(map)
+            {
+                BucketPolicy::enterReadSection();
+            }
+            ReadGuard(const ReadGuard &) = delete;
+            ~ReadGuard()
             {
-                return GlobalClock::clock.get_min_lock() >= deleteTick.load();
+                BucketPolicy::leaveReadSection();
             }
-            bool isDeleted()
+
+            V *get(const K &k)
             {
-                // It is safe if a thread checks isDeleted before another thread marks it deleted. Since the global clock is increased,
-                // by node deletion and the thread has not yet updated the local lock, the thread's local lock will be less than the
-                // deleteTick
-                return deleteTick.load();
+                HashListNode *cur = map.findNode(map.hashOf(k), k);
+                return cur ? &cur->v : nullptr;
             }
         };
 
-        struct DeletionQueue
+        /**
+         * The weakly consistent iterator over the keys of the map. The keys present for the whole iteration are visited
+         * exactly once. The keys inserted or removed during the iteration may or may not be visited. The buckets are not
+         * split while an iterator is alive: the map can be written, but the growth by inserts and reserve() are postponed
+         * until the iterations finish. The iteration should be short like a read section, which it holds. Not supported by
+         * PolicyHazardPointer
+         * */
+        struct Iterator
         {
-            std::mutex lock;
-            std::vector<DeletionFlag *> queue;
-            typedef void (*Deleter)(DeletionFlag *);
-            Deleter deleter;
-            DeletionQueue(Deleter deleter) : deleter(deleter) {}
-            void enqueue(DeletionFlag *p)
+            static_assert(!BucketPolicy::usesHazardPointers, "PolicyHazardPointer protects one returned node per thread");
+            ConHashMap &map;
+            ScanGuard scanGuard;
+            size_t idx = 0;
+            size_t num;
+            HashListNode *cur;
+            Iterator(ConHashMap &map) : map(map), scanGuard(map)
+            {
+                BucketPolicy::enterReadSection();
+                num = map.bucketNum.load(std::memory_order_acquire);
+                cur = map.bucketAt(0).ptr.load(std::memory_order_acquire);
+                skip();
+            }
+            Iterator(const Iterator &) = delete;
+            ~Iterator()
+            {
+                BucketPolicy::leaveReadSection();
+            }
+
+            bool valid() const
+            {
+                return cur != nullptr;
+            }
+
+            const K &key() const
+            {
+                return cur->k;
+            }
+
+            V &value() const
+            {
+                return cur->v;
+            }
+
+            void next()
             {
-                std::lock_guard<std::mutex> guard(lock);
-                queue.emplace_back(p);
+                cur = cur->next.load(std::memory_order_acquire);
+                skip();
             }
 
-            void doGC()
+        private:
+            // move to the first node not removed from (cur), or from the next buckets
+            void skip()
             {
-                updateLocalClock();
-                std::lock_guard<std::mutex> guard(lock);
-                for (auto itr = queue.begin(); itr != queue.end();)
+                for (;;)
                 {
-                    if ((*itr)->readyToDelete())
+                    while (cur && cur->isDeleted())
                     {
-                        deleter(*itr);
-                        itr = queue.erase(itr);
+                        cur = cur->next.load(std::memory_order_acquire);
                     }
-                    else
+                    if (cur || ++idx >= num)
                     {
-                        ++itr;
+                        return;
                     }
+                    cur = map.bucketAt(idx).ptr.load(std::memory_order_acquire);
                 }
             }
-            ~DeletionQueue()
-            {
-                for (auto &p : queue)
-                {
-                    deleter(p);
-                }
-            }
-        };
-    };
-
-    template <typename BucketPolicy, typename K, typename V, typename Hasher = std::hash<K>, typename Comparer = std::equal_to<K>>
-    struct ConHashMap : private BucketPolicy::DeletionQueue
-    {
-        struct HashListNode : public BucketPolicy::DeletionFlag
-        {
-            K k;
-            V v;
-            HashListNode *next;
-        };
-
-        struct Bucket
-        {
-            HashListNode *ptr = {nullptr};
-            SpinLock bucketLock;
         };
 
-        Bucket *buckets;
-        unsigned bucketNum;
-        Hasher hasher;
-        Comparer cmper;
-
-    private:
-        Bucket &getBucket(const K &k)
+        /**
+         * Call fn(const K &key, V &value) on the keys of the map in (numThreads) threads, including the calling one. The
+         * threads take the ranges of buckets in turn. It gives the same guarantees as Iterator, and (fn) should not throw.
+         * (fn) can write to the map. Not supported by PolicyHazardPointer
+         * */
+        template <typename Fn>
+        void parallelForEach(Fn &&fn, unsigned numThreads = std::thread::hardware_concurrency())
         {
-            BucketPolicy::updateLocalClock();
-            uint32_t hashv = hasher(k);
-            return buckets[hashv % bucketNum];
+            static_assert(!BucketPolicy::usesHazardPointers, "PolicyHazardPointer protects one returned node per thread");
+            ScanGuard guard(*this);
+            size_t num = bucketNum.load(std::memory_order_acquire);
+            std::atomic<size_t> nextRange = {0};
+            auto worker = [this, num, &nextRange, &fn](unsigned) {
+                BucketPolicy::enterReadSection();
+                for (;;)
+                {
+                    size_t begin = nextRange.fetch_add(FOREACH_RANGE, std::memory_order_relaxed);
+                    if (begin >= num)
+                    {
+                        break;
+                    }
+                    size_t end = num - begin < FOREACH_RANGE ? num : begin + FOREACH_RANGE;
+                    for (size_t idx = begin; idx < end; idx++)
+                    {
+                        for (HashListNode *cur = bucketAt(idx).ptr.load(std::memory_order_acquire); cur;
+                             cur = cur->next.load(std::memory_order_acquire))
+                        {
+                            if (!cur->isDeleted())
+                            {
+                                fn(static_cast<const K &>(cur->k), cur->v);
+                            }
+                        }
+                    }
+                }
+                BucketPolicy::leaveReadSection();
+            };
+            runThreads(numThreads, worker);
         }
 
-        HashListNode *makeNewNode(const K &k, V &&v, HashListNode *next)
+        template <typename Fn>
+        void forEach(Fn &&fn)
         {
-            HashListNode *ret = new HashListNode();
-            ret->next = next;
-            ret->k = k;
-            ret->v = std::move(v);
-            return ret;
+            parallelForEach(fn, 1);
         }
 
-        HashListNode *makeNewNode(const K &k, const V &v, HashListNode *next)
+        struct MapStats
         {
-            HashListNode *ret = new HashListNode();
-            ret->next = next;
-            ret->k = k;
-            ret->v = v;
-            return ret;
-        }
+            size_t size;
+            size_t buckets;
+            float loadFactor;
+            // chainLengths[i] is the number of the buckets with i nodes. The last one also counts the longer lists
+            std::vector<size_t> chainLengths;
+            // the removed nodes of the map which are not yet freed
+            size_t pendingRemoved;
+            // the ticks of the global clock not yet seen by the slowest thread. The nodes removed in these ticks cannot be
+            // freed yet
+            uint64_t epochLag;
+            // the counters of the map, which are zeros unless KUAI_STATS is defined
+            StatCounters counters;
+        };
 
-        HashListNode *findNode(HashListNode *&head, const K &k, HashListNode *&prevNode)
+        /**
+         * Get the statistics of the map. The lists are measured with the buckets locked one by one and the splits stopped,
+         * so it should not be called frequently on a busy map
+         * */
+        MapStats stats(size_t maxChainLength = 16)
         {
-            for (;;)
+            MapStats ret;
+            ret.chainLengths.assign(maxChainLength + 1, 0);
             {
-                prevNode = nullptr;
-                HashListNode *headNode = head; // reload head node if we met a deleted node
-                bool retry = false;
-                while (headNode)
+                std::lock_guard<std::mutex> guard(resizeLock);
+                size_t num = bucketNum.load(std::memory_order_relaxed);
+                for (size_t idx = 0; idx < num; idx++)
                 {
-                    if (headNode->isDeleted())
-                    {
-                        retry = true;
-                        break;
-                    }
-                    if (cmper(headNode->k, k))
+                    Bucket &buck = bucketAt(idx);
+                    std::lock_guard<LockType> bucketGuard(layout.lockOf(buck, idx));
+                    size_t len = 0;
+                    for (HashListNode *cur = buck.ptr.load(std::memory_order_acquire); cur; cur = cur->next.load(std::memory_order_acquire))
                     {
-                        return headNode;
+                        len++;
                     }
-                    prevNode = headNode;
-                    headNode = headNode->next;
+                    ret.chainLengths[len < maxChainLength ? len : maxChainLength]++;
                 }
-                if (!retry)
-                    return nullptr;
+                ret.buckets = num;
             }
+            ret.size = size();
+            ret.loadFactor = float(ret.size) / ret.buckets;
+            ret.pendingRemoved = pendingOrZero();
+            uint64_t now = GlobalClock::clock.logicalClock.load();
+            uint64_t minClock = GlobalClock::clock.get_min_lock();
+            ret.epochLag = now > minClock ? now - minClock : 0;
+            ret.counters = this->statCounters.total();
+            return ret;
         }
 
-        HashListNode *findNode(HashListNode *&headNode, const K &k)
-        {
-            HashListNode *prevNode;
-            return findNode(headNode, k, prevNode);
-        }
-        static void nodeDeleter(typename BucketPolicy::DeletionFlag *node)
-        {
-            delete static_cast<HashListNode *>(node);
-        }
+        typedef FrozenMap<K, V, Hasher, Comparer, HashMixer> FrozenType;
 
-    public:
-        ConHashMap(size_t numBuckets) : BucketPolicy::DeletionQueue(nodeDeleter)
+        /**
+         * Copy the keys and the values into an immutable FrozenMap, for the read-only phases of the map. The map is
+         * enumerated by an Iterator, so the keys written by other threads during the copy may or may not be in the frozen
+         * map. The hashes of the keys are copied from the nodes
+         * */
+        FrozenType freeze()
         {
-            buckets = new Bucket[numBuckets];
-            bucketNum = numBuckets;
+            std::vector<typename FrozenType::Entry> items;
+            items.reserve(size());
+            for (Iterator itr(*this); itr.valid(); itr.next())
+            {
+                items.push_back(typename FrozenType::Entry{itr.cur->hashv, itr.key(), itr.value()});
+            }
+            return FrozenType(std::move(items));
         }
 
-        ~ConHashMap()
+        /**
+         * Write the keys and the values to the snapshot file at (path), in the order of the buckets. Other threads can
+         * write to the map during the save, with the same guarantees as Iterator. The file replaces (path) only when it
+         * is complete. The keys and the values are written by SnapshotSerializer, which should be specialized for the
+         * types other than the trivially copyable types and std::string. Throws std::runtime_error if the file cannot be
+         * written
+         * */
+        void saveSnapshot(const char *path)
         {
-            for (size_t i = 0; i < bucketNum; i++)
+            SnapshotWriter writer(path);
+            SnapshotHeader header = snapshotHeader();
+            snapshotWrite(writer.buffer, &header, sizeof(header));
             {
-                HashListNode *cur = buckets[i].ptr;
-                while (cur)
+                // the splits are stopped for the whole save, but the read section is only held while a range of buckets is
+                // copied to the buffer, so that the removed nodes can be freed during the file writes
+                ScanGuard guard(*this);
+                size_t num = bucketNum.load(std::memory_order_acquire);
+                for (size_t begin = 0; begin < num; begin += FOREACH_RANGE)
                 {
-                    auto next = cur->next;
-                    delete cur;
-                    cur = next;
+                    size_t end = num - begin < FOREACH_RANGE ? num : begin + FOREACH_RANGE;
+                    {
+                        ReadGuard section(*this);
+                        for (size_t idx = begin; idx < end; idx++)
+                        {
+                            for (HashListNode *cur = bucketAt(idx).ptr.load(std::memory_order_acquire); cur;
+                                 cur = cur->next.load(std::memory_order_acquire))
+                            {
+                                if (!cur->isDeleted())
+                                {
+                                    SnapshotSerializer<K>::write(writer.buffer, cur->k);
+                                    SnapshotSerializer<V>::write(writer.buffer, cur->v);
+                                    header.count++;
+                                }
+                            }
+                        }
+                    }
+                    writer.flushIfFull();
                 }
             }
-            delete[] buckets;
+            writer.finish(header);
+        }
+
+        /**
+         * Insert the keys and the values in the snapshot file at (path) by bulkInsert() with (numThreads) threads. The file
+         * is mapped, and if the keys and the values are fixed-sized, the nodes are made from the mapped records directly.
+         * Throws std::runtime_error if the file is not a snapshot of this type of map
+         * */
+        void loadSnapshot(const char *path, unsigned numThreads = std::thread::hardware_concurrency())
+        {
+            MappedFile file(path);
+            const char *p = file.data;
+            const char *end = file.data + file.size;
+            SnapshotHeader header;
+            memcpy(&header, snapshotRead(p, end, sizeof(header)), sizeof(header));
+            SnapshotHeader expected = snapshotHeader();
+            if (memcmp(header.magic, expected.magic, sizeof(header.magic)) || header.version != expected.version ||
+                header.keySize != expected.keySize || header.valueSize != expected.valueSize)
+            {
+                throw std::runtime_error("The file is not a snapshot of the map");
+            }
+            loadRecords(p, end, header.count, numThreads,
+                        std::integral_constant<bool, SnapshotSerializer<K>::fixedSize && SnapshotSerializer<V>::fixedSize>());
         }
 
         V *get(const K &k)
         {
-            Bucket &buck = getBucket(k);
-            HashListNode *cur = findNode(buck.ptr, k);
+            BucketPolicy::updateLocalClock();
+            HashListNode *cur = findNode(hashOf(k), k);
             if (cur)
             {
                 return &cur->v;
@@ -220,43 +1227,186 @@ namespace Kuai
             return nullptr;
         }
 
+        /**
+         * Find a key of another type without constructing K, like get(StringSlice) on the map of std::string. Needs a
+         * transparent Hasher and Comparer, and the key should have the same hash as the K equal to it
+         * */
+        template <typename KeyLike>
+        typename std::enable_if<isTransparent<KeyLike>::value, V *>::type get(const KeyLike &k)
+        {
+            BucketPolicy::updateLocalClock();
+            HashListNode *cur = findNode(hashOf(k), k);
+            return cur ? &cur->v : nullptr;
+        }
+
         template <typename VType>
         void set(const K &k, VType &&v)
         {
-            Bucket &buck = getBucket(k);
-            std::lock_guard<SpinLock> guard(buck.bucketLock);
-            HashListNode *headNode = buck.ptr;
-            HashListNode *cur = findNode(buck.ptr, k);
-            if (cur)
+            BucketPolicy::updateLocalClock();
+            emplaceWithHash(hashOf(k), k, std::forward<VType>(v));
+        }
+
+        // the key is moved into the map if it is inserted
+        template <typename VType>
+        void set(K &&k, VType &&v)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            emplaceWithHash(hashv, std::move(k), std::forward<VType>(v));
+        }
+
+        /**
+         * Set the value of the key to the value constructed from (args). If the key is inserted, the key and the value are
+         * constructed in the node. Otherwise the existing value is assigned from the new one
+         * */
+        template <typename... Args>
+        void emplace(const K &k, Args &&... args)
+        {
+            BucketPolicy::updateLocalClock();
+            emplaceWithHash(hashOf(k), k, std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        void emplace(K &&k, Args &&... args)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            emplaceWithHash(hashv, std::move(k), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Insert the value constructed from (args) in the node if the key is not found, and return nullptr. Otherwise
+         * return the existing value, and (args) are not used
+         * */
+        template <typename... Args>
+        V *tryEmplace(const K &k, Args &&... args)
+        {
+            BucketPolicy::updateLocalClock();
+            return tryEmplaceWithHash(hashOf(k), k, std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        V *tryEmplace(K &&k, Args &&... args)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            return tryEmplaceWithHash(hashv, std::move(k), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Get the values of n keys. out[i] is set to the pointer to the value of keys[i], or nullptr if it is not found.
+         * The buckets and then the head nodes of every PREFETCH_BATCH keys are prefetched before the lookups, so that their
+         * cache misses overlap. Not supported by PolicyHazardPointer, which protects one returned node per thread
+         * */
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<!Dummy::usesHazardPointers>::type getBatch(const K *keys, size_t n, V **out)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashes[PREFETCH_BATCH];
+            for (size_t base = 0; base < n; base += PREFETCH_BATCH)
             {
-                cur->v = std::forward<VType>(v);
-                return;
+                size_t cnt = n - base < PREFETCH_BATCH ? n - base : PREFETCH_BATCH;
+                prefetchKeys(keys + base, cnt, hashes, false);
+                for (size_t i = 0; i < cnt; i++)
+                {
+                    HashListNode *cur = findNode(hashes[i], keys[base + i]);
+                    out[base + i] = cur ? &cur->v : nullptr;
+                }
             }
-            buck.ptr = makeNewNode(k, std::forward<VType>(v), headNode);
         }
 
-        template <typename Dummy = BucketPolicy>
-        typename std::enable_if<Dummy::canRemove>::type remove(const K &k)
+        /**
+         * Set the values of n keys, like calling set(keys[i], values[i]) for each i
+         * */
+        void setBatch(const K *keys, const V *values, size_t n)
         {
-            Bucket &buck = getBucket(k);
-            std::lock_guard<SpinLock> guard(buck.bucketLock);
-            HashListNode *prevNode;
-            HashListNode *cur = findNode(buck.ptr, k, prevNode);
-            if (cur)
+            BucketPolicy::updateLocalClock();
+            uint64_t hashes[PREFETCH_BATCH];
+            for (size_t base = 0; base < n; base += PREFETCH_BATCH)
             {
-                if (prevNode)
+                size_t cnt = n - base < PREFETCH_BATCH ? n - base : PREFETCH_BATCH;
+                prefetchKeys(keys + base, cnt, hashes, true);
+                for (size_t i = 0; i < cnt; i++)
                 {
-                    prevNode->next = cur->next;
+                    emplaceWithHash(hashes[i], keys[base + i], values[base + i]);
                 }
-                else
+            }
+        }
+
+        /**
+         * Insert the pairs in [first, last) with (numThreads) threads, including the calling one. The map is grown for the
+         * new keys first, and the buckets are not split during the insert. Each thread takes the items in a range of the
+         * buckets, builds the lists of the new nodes of each bucket privately and links each list with a single update of
+         * the bucket head. The existing values of the keys are replaced, and the later pair of the same key in the input
+         * wins. (Iter) should be a random access iterator of the pairs of (K, V), like std::pair<K, V>. Other threads can
+         * access the map during the insert, and the keys may become visible before it returns. The constructors of K and
+         * V should not throw
+         * */
+        template <typename Iter>
+        void bulkInsert(Iter first, Iter last, unsigned numThreads = std::thread::hardware_concurrency())
+        {
+            BucketPolicy::updateLocalClock();
+            size_t n = last - first;
+            numThreads = numThreads ? numThreads : 1;
+            std::lock_guard<std::mutex> guard(resizeLock);
+            growTo(size_t((size() + n) / maxLoadFactor));
+            size_t mask = levelMask.load(std::memory_order_relaxed);
+            size_t num = bucketNum.load(std::memory_order_relaxed);
+            // the bucket (idx) is owned by thread (idx * numThreads / num)
+            auto ownerOf = [mask, num, numThreads](uint64_t hashv) {
+                return unsigned(bucketIndex(hashv, mask, num) * numThreads / num);
+            };
+            auto chunkBegin = [n, numThreads](unsigned tid) { return n * tid / numThreads; };
+            std::vector<uint64_t> hashes(n);
+            // the items of the chunk (tid) of the input owned by thread (owner) are put at offsets[tid * numThreads + owner]
+            std::vector<size_t> offsets(numThreads * numThreads);
+            runThreads(numThreads, [&](unsigned tid) {
+                std::vector<size_t> counts(numThreads);
+                for (size_t i = chunkBegin(tid); i < chunkBegin(tid + 1); i++)
                 {
-                    buck.ptr = cur->next;
+                    hashes[i] = hashOf(first[i].first);
+                    counts[ownerOf(hashes[i])]++;
+                }
+                std::copy(counts.begin(), counts.end(), offsets.begin() + tid * numThreads);
+            });
+            // the items of an owner are contiguous in (order), and keep their order in the input
+            std::vector<size_t> ownerBegin(numThreads + 1);
+            size_t pos = 0;
+            for (unsigned owner = 0; owner < numThreads; owner++)
+            {
+                ownerBegin[owner] = pos;
+                for (unsigned tid = 0; tid < numThreads; tid++)
+                {
+                    size_t cnt = offsets[tid * numThreads + owner];
+                    offsets[tid * numThreads + owner] = pos;
+                    pos += cnt;
                 }
-                cur->markDeleted();
-                this->enqueue(cur);
-                return;
             }
-            throw std::runtime_error("Cannot find the key!");
+            ownerBegin[numThreads] = n;
+            std::vector<size_t> order(n);
+            runThreads(numThreads, [&](unsigned tid) {
+                size_t *off = &offsets[tid * numThreads];
+                for (size_t i = chunkBegin(tid); i < chunkBegin(tid + 1); i++)
+                {
+                    order[off[ownerOf(hashes[i])]++] = i;
+                }
+            });
+            runThreads(numThreads, [&](unsigned tid) {
+                bulkInsertOwned(first, hashes.data(), order.data() + ownerBegin[tid], ownerBegin[tid + 1] - ownerBegin[tid],
+                                mask, num, tid);
+            });
+        }
+
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type remove(const K &k)
+        {
+            removeKey(k);
+        }
+
+        template <typename KeyLike, typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove && isTransparent<KeyLike>::value>::type remove(const KeyLike &k)
+        {
+            removeKey(k);
         }
 
         template <typename Dummy = BucketPolicy>
@@ -265,19 +1415,233 @@ namespace Kuai
             this->doGC();
         }
 
+        /**
+         * Let the removers free the removed nodes automatically. A remover runs a GC pass when it has removed
+         * (retireThreshold) nodes since the last pass. If (memoryCapBytes) is not 0, a remover waits for the GC passes when
+         * the removed but not freed nodes take more than (memoryCapBytes) bytes. The cap is best effort: the nodes cannot
+         * be freed while a thread has not updated its local clock since the removal. PolicyHazardPointer always frees the
+         * nodes automatically, and (retireThreshold) is the length of the retire list which starts a scan
+         * */
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type setReclaimThreshold(size_t retireThreshold, size_t memoryCapBytes = 0)
+        {
+            this->reclaimThreshold = retireThreshold;
+            this->maxPending = memoryCapBytes / sizeof(HashListNode);
+            if (memoryCapBytes && !this->maxPending)
+            {
+                this->maxPending = 1;
+            }
+        }
+
+        /**
+         * Run the GC passes in a background thread every (interval), or earlier when a remover reaches the reclaim
+         * threshold. The thread is stopped when the map is destroyed. Not supported by PolicyHazardPointer
+         * */
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type startReclaimer(std::chrono::milliseconds interval)
+        {
+            this->BucketPolicy::DeletionQueue::startReclaimer(interval);
+        }
+
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type stopReclaimer()
+        {
+            this->BucketPolicy::DeletionQueue::stopReclaimer();
+        }
+
+        // the number of removed nodes which are not yet freed
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove, size_t>::type pendingRemoved()
+        {
+            return this->pending();
+        }
+
         template <typename VType>
         V *setIfAbsent(const K &k, VType &&v)
         {
-            Bucket &buck = getBucket(k);
-            std::lock_guard<SpinLock> guard(buck.bucketLock);
-            HashListNode *headNode = buck.ptr;
-            HashListNode *cur = findNode(buck.ptr, k);
+            BucketPolicy::updateLocalClock();
+            return tryEmplaceWithHash(hashOf(k), k, std::forward<VType>(v));
+        }
+
+        template <typename VType>
+        V *setIfAbsent(K &&k, VType &&v)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            return tryEmplaceWithHash(hashv, std::move(k), std::forward<VType>(v));
+        }
+
+        // K is only constructed from the key when it is inserted
+        template <typename KeyLike, typename VType>
+        typename std::enable_if<isTransparent<KeyLike>::value, V *>::type setIfAbsent(const KeyLike &k, VType &&v)
+        {
+            BucketPolicy::updateLocalClock();
+            return tryEmplaceWithHash(hashOf(k), k, std::forward<VType>(v));
+        }
+
+        /**
+         * Update the value of the key in place with the bucket locked. (fn) is called as fn(V &value, bool found). If the
+         * key is not found, (value) is a value-initialized V, which is inserted after (fn) returns. Returns true if the
+         * key is inserted. If lock-free insert is enabled and another thread inserts the key at the same time, (fn) may be
+         * called on the new value and then called again on the value inserted by the other thread
+         * */
+        template <typename Fn>
+        bool compute(const K &k, Fn &&fn)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            {
+                LockType *lock;
+                Bucket &buck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                HashListNode *spare;
+                HashListNode *cur = linkIfAbsent(buck, hashv, k, spare, [&]() {
+                    HashListNode *node = makeNewNode(hashv, k);
+                    try
+                    {
+                        fn(node->v, false);
+                    }
+                    catch (...)
+                    {
+                        // the key is not inserted
+                        freeNode(node);
+                        throw;
+                    }
+                    return node;
+                });
+                if (cur)
+                {
+                    if (spare)
+                    {
+                        freeNode(spare);
+                    }
+                    fn(cur->v, true);
+                    return false;
+                }
+            }
+            addCount(hashv, 1);
+            return true;
+        }
+
+        /**
+         * Get the value of the key. If the key is not found, insert the value returned by factory(), which is only called
+         * when the key is inserted
+         * */
+        template <typename Factory>
+        V *computeIfAbsent(const K &k, Factory &&factory)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            HashListNode *made = nullptr;
+            {
+                LockType *lock;
+                Bucket &buck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                HashListNode *spare;
+                HashListNode *cur = linkIfAbsent(buck, hashv, k, spare, [&]() {
+                    made = makeNewNode(hashv, k, factory());
+                    return made;
+                });
+                if (cur)
+                {
+                    if (spare)
+                    {
+                        freeNode(spare);
+                    }
+                    BucketPolicy::pin(cur);
+                    return &cur->v;
+                }
+                BucketPolicy::pin(made);
+            }
+            addCount(hashv, 1);
+            return &made->v;
+        }
+
+        /**
+         * Insert (v) if the key is not found. Otherwise call fn(V &value, const VType &v) with the bucket locked to merge
+         * (v) into the value in place. Returns true if the key is inserted
+         * */
+        template <typename VType, typename Fn>
+        bool merge(const K &k, VType &&v, Fn &&fn)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            {
+                LockType *lock;
+                Bucket &buck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                HashListNode *spare;
+                HashListNode *cur = linkIfAbsent(buck, hashv, k, spare, [&]() {
+                    return makeNewNode(hashv, k, std::forward<VType>(v));
+                });
+                if (cur)
+                {
+                    if (spare)
+                    {
+                        // the key is inserted by a lock-free inserter after the value is moved to the spare node
+                        fn(cur->v, spare->v);
+                        freeNode(spare);
+                    }
+                    else
+                    {
+                        fn(cur->v, v);
+                    }
+                    return false;
+                }
+            }
+            addCount(hashv, 1);
+            return true;
+        }
+
+        /**
+         * Add (delta) to the value of the key and return the old value. If the key is not found, insert (delta) and return
+         * 0. For the integral values except bool. An existing value is updated by an atomic RMW without the lock, so only
+         * the insertions lock the bucket. It is not atomic with the writes under the bucket lock: the updates of the same
+         * key by set(), emplace(), compute() or merge() at the same time may be lost, or lose the added delta. The keys
+         * updated concurrently should only be updated by fetchAdd() and increment()
+         * */
+        template <typename Dummy = V>
+        typename std::enable_if<std::is_integral<Dummy>::value && !std::is_same<Dummy, bool>::value, V>::type fetchAdd(const K &k, V delta)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            HashListNode *cur = findNode(hashv, k);
             if (cur)
             {
-                return &cur->v;
+                return __atomic_fetch_add(&cur->v, delta, __ATOMIC_RELAXED);
             }
-            buck.ptr = makeNewNode(k, std::forward<VType>(v), headNode);
-            return nullptr;
+            V old = 0;
+            bool inserted;
+            {
+                LockType *lock;
+                Bucket &buck = lockBucket(hashv, lock);
+                std::lock_guard<LockType> guard(*lock, std::adopt_lock);
+                HashListNode *spare;
+                cur = linkIfAbsent(buck, hashv, k, spare, [&]() { return makeNewNode(hashv, k, delta); });
+                inserted = !cur;
+                if (cur)
+                {
+                    // inserted by another thread after findNode
+                    if (spare)
+                    {
+                        freeNode(spare);
+                    }
+                    old = __atomic_fetch_add(&cur->v, delta, __ATOMIC_RELAXED);
+                }
+            }
+            if (inserted)
+            {
+                addCount(hashv, 1);
+            }
+            return old;
+        }
+
+        // add (delta) to the value of the key, inserting it if the key is not found. Returns the new value. Like fetchAdd(),
+        // it is not atomic with the locked writes of the same key
+        template <typename Dummy = V>
+        typename std::enable_if<std::is_integral<Dummy>::value && !std::is_same<Dummy, bool>::value, V>::type increment(const K &k, V delta = 1)
+        {
+            return fetchAdd(k, delta) + delta;
         }
     };
-} // namespace Kuai
\ No newline at end of file
+} // namespace Kuai
@@ -0,0 +1,581 @@
+#pragma once
+#include "SpinLock.hpp"
+#include "BucketPolicy.hpp"
+#include "Hash.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <functional>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Kuai
+{
+
+    /**
+     * The concurrent hash map with open addressing. The keys and values are stored inline in the slots, so that a lookup
+     * does not chase the pointers of a list. The slots are grouped by GROUP_SIZE, and each group has a control byte per
+     * slot holding 7 bits of the hash of the key (or EMPTY/DELETED), which are matched with SSE2 in one instruction.
+     *
+     * Readers are lock-free. They copy the key-value pairs out of a group and validate the copy with the sequence lock of
+     * the group. Writers lock the first group in the probe sequence of the key (the home group), so the writers of the same
+     * key are serialized. They also lock the group of the slot to change, if it is not the home group.
+     *
+     * The keys and values are copied by readers while they may be changed, so they should be trivially copyable
+     * */
+    template <typename BucketPolicy, typename K, typename V, typename Hasher = std::hash<K>, typename Comparer = std::equal_to<K>,
+              typename HashMixer = typename DefaultMixer<Hasher>::type>
+    struct FlatHashMap : private BucketPolicy::DeletionQueue
+    {
+        // the readers do not publish the tables they are reading
+        static_assert(!BucketPolicy::usesHazardPointers, "FlatHashMap does not support PolicyHazardPointer");
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                      "FlatHashMap requires trivially copyable keys and values");
+
+        static constexpr unsigned GROUP_SIZE = 16;
+        static constexpr int8_t EMPTY = -128;
+        static constexpr int8_t DELETED = -2;
+        static constexpr unsigned COUNTER_STRIPES = 16;
+
+        struct Group
+        {
+            alignas(16) int8_t ctrl[GROUP_SIZE];
+            // odd when a writer is changing the group
+            std::atomic<uint32_t> seq = {0};
+            SpinLock lock;
+            K keys[GROUP_SIZE];
+            V values[GROUP_SIZE];
+            Group()
+            {
+                memset(ctrl, EMPTY, GROUP_SIZE);
+            }
+        };
+
+        /**
+         * The table is replaced by a larger one when the used slots (including the DELETED ones) exceed 7/8 of the
+         * slots. The old table is locked and frozen before it is replaced, and it is kept until no reader can see it
+         * */
+        struct Table : public BucketPolicy::DeletionFlag
+        {
+            size_t groupMask;
+            size_t maxUsed;
+            Group *groups;
+            std::atomic<size_t> used = {0};
+            // set when the table is replaced. The writers locking a group of a moved table should retry on the new table
+            std::atomic<bool> moved = {false};
+            // links the replaced tables of PolicyNoRemove maps in (oldTables). The removable maps retire the tables through
+            // the link in DeletionFlag instead
+            Table *nextOldTable = nullptr;
+            Table(size_t numGroups) : groupMask(numGroups - 1), maxUsed(numGroups * GROUP_SIZE / 8 * 7), groups(new Group[numGroups]) {}
+            ~Table()
+            {
+                delete[] groups;
+            }
+        };
+
+        struct alignas(64) Counter
+        {
+            std::atomic<int64_t> v = {0};
+        };
+
+        std::atomic<Table *> table;
+        // the tables replaced by PolicyNoRemove maps. They are freed when the map is destroyed
+        Table *oldTables = nullptr;
+        std::mutex resizeLock;
+        Counter counters[COUNTER_STRIPES];
+        Hasher hasher;
+        Comparer cmper;
+
+    private:
+        enum ProbeResult
+        {
+            FOUND,
+            // the key is not in the group, and the group has an EMPTY slot, so the key is not in the table
+            ABSENT,
+            NEXT_GROUP,
+        };
+
+        enum LockResult
+        {
+            LOCK_FOUND,
+            LOCK_INSERTABLE,
+            LOCK_NOT_FOUND,
+            LOCK_RETRY,
+            LOCK_GROW,
+        };
+
+        static uint32_t matchByte(const int8_t *ctrl, int8_t b)
+        {
+#ifdef __SSE2__
+            __m128i c = _mm_load_si128((const __m128i *)ctrl);
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(b)));
+#else
+            uint32_t ret = 0;
+            for (unsigned i = 0; i < GROUP_SIZE; i++)
+            {
+                ret |= uint32_t(ctrl[i] == b) << i;
+            }
+            return ret;
+#endif
+        }
+
+        // match the EMPTY and DELETED slots, which have the highest bit set
+        static uint32_t matchFree(const int8_t *ctrl)
+        {
+#ifdef __SSE2__
+            return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+            uint32_t ret = 0;
+            for (unsigned i = 0; i < GROUP_SIZE; i++)
+            {
+                ret |= uint32_t(ctrl[i] < 0) << i;
+            }
+            return ret;
+#endif
+        }
+
+        uint64_t hashOf(const K &k)
+        {
+            return HashMixer::mix(hasher(k));
+        }
+
+        static int8_t ctrlOf(uint64_t hashv)
+        {
+            return int8_t(hashv & 0x7f);
+        }
+
+        static size_t groupIndex(uint64_t hashv, size_t mask)
+        {
+            return (hashv >> 7) & mask;
+        }
+
+        static void beginWrite(Group &g)
+        {
+            g.seq.store(g.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        static void endWrite(Group &g)
+        {
+            g.seq.store(g.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // find the key in a consistent snapshot of the group. Copies the value to (out) if it is not null. (freeMask) is set
+        // to the free slots in the snapshot
+        ProbeResult readGroup(Group &g, int8_t h2, const K &k, unsigned &slot, V *out, uint32_t &freeMask)
+        {
+            for (;;)
+            {
+                uint32_t seq = g.seq.load(std::memory_order_acquire);
+                if (seq & 1)
+                {
+                    continue;
+                }
+                ProbeResult ret = NEXT_GROUP;
+                for (uint32_t match = matchByte(g.ctrl, h2); match; match &= match - 1)
+                {
+                    unsigned idx = __builtin_ctz(match);
+                    K key = g.keys[idx];
+                    if (cmper(key, k))
+                    {
+                        if (out)
+                        {
+                            *out = g.values[idx];
+                        }
+                        slot = idx;
+                        ret = FOUND;
+                        break;
+                    }
+                }
+                freeMask = matchFree(g.ctrl);
+                if (ret != FOUND && matchByte(g.ctrl, EMPTY))
+                {
+                    ret = ABSENT;
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (g.seq.load(std::memory_order_relaxed) == seq)
+                {
+                    return ret;
+                }
+            }
+        }
+
+        // lock the home group of the key in the current table
+        Table *lockHome(uint64_t hashv, Group *&home)
+        {
+            for (;;)
+            {
+                Table *t = table.load(std::memory_order_acquire);
+                Group &g = t->groups[groupIndex(hashv, t->groupMask)];
+                g.lock.lock();
+                // the table is moved while all of its groups are locked
+                if (!t->moved.load(std::memory_order_relaxed))
+                {
+                    home = &g;
+                    return t;
+                }
+                g.lock.unlock();
+            }
+        }
+
+        /**
+         * Find the slot of the key and lock its group. If the key is not found and (insert) is true, lock a group with a
+         * free slot for the key instead. The caller should hold the lock of the home group. A group other than the home
+         * group is only try-locked, and LOCK_RETRY is returned on failure, so that two writers will not wait for each other
+         * */
+        LockResult lockSlot(Table *t, Group &home, uint64_t hashv, const K &k, bool insert, Group *&outGroup, unsigned &outSlot)
+        {
+            int8_t h2 = ctrlOf(hashv);
+            size_t numGroups = t->groupMask + 1;
+            for (;;)
+            {
+                Group *freeGroup = nullptr;
+                size_t idx = groupIndex(hashv, t->groupMask);
+                for (size_t i = 1; i <= numGroups; i++)
+                {
+                    Group &g = t->groups[idx];
+                    uint32_t freeMask;
+                    // the slot of the key will not change, because we are holding the lock of its home group
+                    ProbeResult r = readGroup(g, h2, k, outSlot, nullptr, freeMask);
+                    if (r == FOUND)
+                    {
+                        if (&g != &home && !g.lock.try_lock())
+                        {
+                            return LOCK_RETRY;
+                        }
+                        outGroup = &g;
+                        return LOCK_FOUND;
+                    }
+                    if (!freeGroup && freeMask)
+                    {
+                        freeGroup = &g;
+                    }
+                    if (r == ABSENT)
+                    {
+                        break;
+                    }
+                    // triangular probing visits all groups when the number of groups is a power of 2
+                    idx = (idx + i) & t->groupMask;
+                }
+                if (!insert)
+                {
+                    return LOCK_NOT_FOUND;
+                }
+                if (!freeGroup)
+                {
+                    return LOCK_GROW;
+                }
+                if (freeGroup != &home && !freeGroup->lock.try_lock())
+                {
+                    return LOCK_RETRY;
+                }
+                uint32_t freeMask = matchFree(freeGroup->ctrl);
+                if (freeMask)
+                {
+                    outGroup = freeGroup;
+                    outSlot = __builtin_ctz(freeMask);
+                    return LOCK_INSERTABLE;
+                }
+                // the free slots are taken by other writers
+                if (freeGroup != &home)
+                {
+                    freeGroup->lock.unlock();
+                }
+            }
+        }
+
+        /**
+         * Lock the slot of the key and call func(table, group, slot, result) with the locks held. (group) is null if the key
+         * is not found and (insert) is false. Grows the table if there is no free slot for insertion
+         * */
+        template <typename Func>
+        void withSlot(uint64_t hashv, const K &k, bool insert, Func &&func)
+        {
+            for (;;)
+            {
+                Group *home;
+                Table *t = lockHome(hashv, home);
+                if (insert && t->used.load(std::memory_order_relaxed) >= t->maxUsed)
+                {
+                    home->lock.unlock();
+                    grow(t);
+                    continue;
+                }
+                Group *g = nullptr;
+                unsigned slot = 0;
+                LockResult r = lockSlot(t, *home, hashv, k, insert, g, slot);
+                if (r == LOCK_RETRY || r == LOCK_GROW)
+                {
+                    home->lock.unlock();
+                    if (r == LOCK_GROW)
+                    {
+                        grow(t);
+                    }
+                    continue;
+                }
+                func(t, g, slot, r);
+                if (g && g != home)
+                {
+                    g->lock.unlock();
+                }
+                home->lock.unlock();
+                return;
+            }
+        }
+
+        void insertAt(Table *t, Group &g, unsigned slot, uint64_t hashv, const K &k, const V &v)
+        {
+            bool wasEmpty = g.ctrl[slot] == EMPTY;
+            beginWrite(g);
+            g.keys[slot] = k;
+            g.values[slot] = v;
+            g.ctrl[slot] = ctrlOf(hashv);
+            endWrite(g);
+            if (wasEmpty)
+            {
+                t->used.fetch_add(1, std::memory_order_relaxed);
+            }
+            counters[hashv % COUNTER_STRIPES].v.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // insert into a table which is not yet published
+        static void insertUnpublished(Table *t, uint64_t hashv, const K &k, const V &v)
+        {
+            size_t idx = groupIndex(hashv, t->groupMask);
+            for (size_t i = 1;; i++)
+            {
+                Group &g = t->groups[idx];
+                uint32_t freeMask = matchFree(g.ctrl);
+                if (freeMask)
+                {
+                    unsigned slot = __builtin_ctz(freeMask);
+                    g.keys[slot] = k;
+                    g.values[slot] = v;
+                    g.ctrl[slot] = ctrlOf(hashv);
+                    return;
+                }
+                idx = (idx + i) & t->groupMask;
+            }
+        }
+
+        /**
+         * Replace the table with a new one holding the live keys of it. The table is doubled until the live keys take at
+         * most half of the max used slots, so a table full of DELETED slots is rehashed in the same size
+         * */
+        void grow(Table *t)
+        {
+            std::lock_guard<std::mutex> guard(resizeLock);
+            if (table.load(std::memory_order_relaxed) != t)
+            {
+                // another thread has replaced it
+                return;
+            }
+            size_t numGroups = t->groupMask + 1;
+            for (size_t i = 0; i < numGroups; i++)
+            {
+                t->groups[i].lock.lock();
+            }
+            size_t live = 0;
+            for (size_t i = 0; i < numGroups; i++)
+            {
+                live += GROUP_SIZE - __builtin_popcount(matchFree(t->groups[i].ctrl));
+            }
+            size_t newGroups = numGroups;
+            while (live * 2 > newGroups * GROUP_SIZE / 8 * 7)
+            {
+                newGroups *= 2;
+            }
+            Table *newTable = new Table(newGroups);
+            for (size_t i = 0; i < numGroups; i++)
+            {
+                Group &g = t->groups[i];
+                for (unsigned s = 0; s < GROUP_SIZE; s++)
+                {
+                    if (g.ctrl[s] >= 0)
+                    {
+                        insertUnpublished(newTable, hashOf(g.keys[s]), g.keys[s], g.values[s]);
+                    }
+                }
+            }
+            newTable->used.store(live, std::memory_order_relaxed);
+            table.store(newTable, std::memory_order_release);
+            t->moved.store(true, std::memory_order_relaxed);
+            for (size_t i = 0; i < numGroups; i++)
+            {
+                t->groups[i].lock.unlock();
+            }
+            retireTable(t, std::integral_constant<bool, BucketPolicy::canRemove>());
+        }
+
+        // the readers may still read the old table. Free it when all threads have updated their local clocks
+        void retireTable(Table *t, std::true_type)
+        {
+            t->markDeleted();
+            this->enqueue(t);
+        }
+
+        void retireTable(Table *t, std::false_type)
+        {
+            t->nextOldTable = oldTables;
+            oldTables = t;
+        }
+
+        static void tableDeleter(typename BucketPolicy::DeletionQueue *queue, typename BucketPolicy::DeletionFlag *t)
+        {
+            delete static_cast<Table *>(t);
+        }
+
+    public:
+        /**
+         * Create the map with the initial number of slots, which is rounded up to a power of 2 and at least GROUP_SIZE
+         * */
+        FlatHashMap(size_t numSlots) : BucketPolicy::DeletionQueue(tableDeleter)
+        {
+            size_t numGroups = 1;
+            while (numGroups * GROUP_SIZE < numSlots)
+            {
+                numGroups *= 2;
+            }
+            table.store(new Table(numGroups), std::memory_order_release);
+        }
+
+        FlatHashMap(const FlatHashMap &) = delete;
+
+        ~FlatHashMap()
+        {
+            delete table.load();
+            while (oldTables)
+            {
+                auto next = oldTables->nextOldTable;
+                delete oldTables;
+                oldTables = next;
+            }
+        }
+
+        /**
+         * Get the approximate number of key-value pairs in the map
+         * */
+        size_t size()
+        {
+            int64_t ret = 0;
+            for (auto &c : counters)
+            {
+                ret += c.v.load(std::memory_order_relaxed);
+            }
+            return ret > 0 ? ret : 0;
+        }
+
+        /**
+         * Get the number of slots in the current table
+         * */
+        size_t capacity()
+        {
+            return (table.load(std::memory_order_acquire)->groupMask + 1) * GROUP_SIZE;
+        }
+
+        /**
+         * Copy the value of the key to (out). Returns false if the key is not found
+         * */
+        bool get(const K &k, V &out)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            int8_t h2 = ctrlOf(hashv);
+            Table *t = table.load(std::memory_order_acquire);
+            size_t idx = groupIndex(hashv, t->groupMask);
+            for (size_t i = 1; i <= t->groupMask + 1; i++)
+            {
+                unsigned slot;
+                uint32_t freeMask;
+                ProbeResult r = readGroup(t->groups[idx], h2, k, slot, &out, freeMask);
+                if (r != NEXT_GROUP)
+                {
+                    return r == FOUND;
+                }
+                idx = (idx + i) & t->groupMask;
+            }
+            return false;
+        }
+
+        void set(const K &k, const V &v)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            withSlot(hashv, k, true, [&](Table *t, Group *g, unsigned slot, LockResult r) {
+                if (r == LOCK_FOUND)
+                {
+                    beginWrite(*g);
+                    g->values[slot] = v;
+                    endWrite(*g);
+                }
+                else
+                {
+                    insertAt(t, *g, slot, hashv, k, v);
+                }
+            });
+        }
+
+        /**
+         * Insert the key-value pair if the key is not in the map. Returns false and copies the value of the key to (old)
+         * if the key exists
+         * */
+        bool setIfAbsent(const K &k, const V &v, V &old)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            bool inserted = false;
+            withSlot(hashv, k, true, [&](Table *t, Group *g, unsigned slot, LockResult r) {
+                if (r == LOCK_FOUND)
+                {
+                    old = g->values[slot];
+                }
+                else
+                {
+                    insertAt(t, *g, slot, hashv, k, v);
+                    inserted = true;
+                }
+            });
+            return inserted;
+        }
+
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type remove(const K &k)
+        {
+            BucketPolicy::updateLocalClock();
+            uint64_t hashv = hashOf(k);
+            bool found = false;
+            withSlot(hashv, k, false, [&](Table *t, Group *g, unsigned slot, LockResult r) {
+                if (r != LOCK_FOUND)
+                {
+                    return;
+                }
+                // the probes of readers stop at a group with EMPTY slots, so the slot can be EMPTY if the group has one
+                bool canEmpty = matchByte(g->ctrl, EMPTY);
+                beginWrite(*g);
+                g->ctrl[slot] = canEmpty ? EMPTY : DELETED;
+                endWrite(*g);
+                if (canEmpty)
+                {
+                    t->used.fetch_sub(1, std::memory_order_relaxed);
+                }
+                found = true;
+            });
+            if (!found)
+            {
+                throw std::runtime_error("Cannot find the key!");
+            }
+            counters[hashv % COUNTER_STRIPES].v.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Free the old tables which are no longer visible to the readers
+         * */
+        template <typename Dummy = BucketPolicy>
+        typename std::enable_if<Dummy::canRemove>::type garbageCollect()
+        {
+            this->doGC();
+        }
+    };
+} // namespace Kuai
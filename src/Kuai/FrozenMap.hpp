@@ -0,0 +1,107 @@
+#pragma once
+#include "Hash.hpp"
+#include <stdint.h>
+#include <vector>
+#include <utility>
+#include <functional>
+
+namespace Kuai
+{
+    /**
+     * The immutable hash map made by ConHashMap::freeze(), for the read-only phases of a map. The entries are stored in
+     * one contiguous array sorted by bucket, and bucket i holds the entries in [offsets[i], offsets[i + 1]). There are no
+     * list nodes, deletion ticks or locks, and get() only scans the entries of one bucket. Concurrent get() calls need no
+     * synchronization. The hash of an entry is kept with it, so the keys are only compared when the hashes are equal
+     * */
+    template <typename K, typename V, typename Hasher = std::hash<K>, typename Comparer = std::equal_to<K>,
+              typename HashMixer = typename DefaultMixer<Hasher>::type>
+    struct FrozenMap
+    {
+        struct Entry
+        {
+            uint64_t hashv;
+            K k;
+            V v;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<size_t> offsets;
+        size_t mask;
+        Hasher hasher;
+        Comparer cmper;
+
+        // the empty map
+        FrozenMap() : offsets(2, 0), mask(0) {}
+
+        /**
+         * Make the map from the entries, whose hashv should be HashMixer::mix(hasher(k)). The keys should be distinct.
+         * The number of buckets is the number of entries rounded up to a power of 2
+         * */
+        FrozenMap(std::vector<Entry> &&items)
+        {
+            size_t num = 1;
+            while (num < items.size())
+            {
+                num *= 2;
+            }
+            mask = num - 1;
+            offsets.assign(num + 1, 0);
+            for (auto &e : items)
+            {
+                offsets[(e.hashv & mask) + 1]++;
+            }
+            for (size_t i = 1; i <= num; i++)
+            {
+                offsets[i] += offsets[i - 1];
+            }
+            // counting sort by bucket
+            std::vector<size_t> order(items.size());
+            std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                order[pos[items[i].hashv & mask]++] = i;
+            }
+            entries.reserve(items.size());
+            for (size_t i : order)
+            {
+                entries.push_back(std::move(items[i]));
+            }
+        }
+
+        size_t size() const
+        {
+            return entries.size();
+        }
+
+        size_t bucketCount() const
+        {
+            return mask + 1;
+        }
+
+        const V *get(const K &k) const
+        {
+            uint64_t hashv = HashMixer::mix(hasher(k));
+            size_t idx = hashv & mask;
+            const Entry *cur = entries.data() + offsets[idx];
+            const Entry *end = entries.data() + offsets[idx + 1];
+            for (; cur != end; ++cur)
+            {
+                if (cur->hashv == hashv && cmper(cur->k, k))
+                {
+                    return &cur->v;
+                }
+            }
+            return nullptr;
+        }
+
+        // call fn(const K &key, const V &value) on the entries in the order of the buckets
+        template <typename Fn>
+        void forEach(Fn &&fn) const
+        {
+            for (auto &e : entries)
+            {
+                fn(e.k, e.v);
+            }
+        }
+    };
+} // namespace Kuai
@@ -1,7 +1,13 @@
 #pragma once
 #include "LogicalClock.hpp"
+#include "ThreadSlot.hpp"
+#include "HazardPointer.hpp"
 namespace Kuai
 {
 GlobalClock GlobalClock::clock;
 thread_local ThreadClock ThreadClock::tls_clock;
+std::atomic<uint64_t> ThreadSlot::usedSlots[ThreadSlot::MAX_SLOTS / 64];
+thread_local ThreadSlot ThreadSlot::tls_slot;
+HazardRegistry HazardRegistry::registry;
+thread_local HazardRecord HazardRecord::tls_record;
 } // namespace Kuai
\ No newline at end of file
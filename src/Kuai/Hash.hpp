@@ -0,0 +1,164 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+namespace Kuai
+{
+    /**
+     * The maps index the buckets with the low bits of the hash. The hash mixer is applied to the result of the Hasher before
+     * indexing, so that the hashers with poor low bits (like std::hash<int>, which is the identity) do not cluster the keys
+     * */
+
+    // for the hashers which already spread the keys over all bits of the hash
+    struct MixNone
+    {
+        static uint64_t mix(uint64_t h)
+        {
+            return h;
+        }
+    };
+
+    // the finalizer of MurmurHash3
+    struct MixMurmur
+    {
+        static uint64_t mix(uint64_t h)
+        {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    /**
+     * A non-owning view of a string, like std::string_view in C++17. It can be used as the key in the lookups of the maps
+     * with std::string keys and transparent hashers, for example on the tokens of a parsed buffer
+     * */
+    struct StringSlice
+    {
+        const char *data;
+        size_t size;
+        StringSlice(const char *data, size_t size) : data(data), size(size) {}
+        StringSlice(const char *str) : data(str), size(strlen(str)) {}
+        StringSlice(const std::string &str) : data(str.data()), size(str.size()) {}
+
+        // a key is only materialized when a slice is inserted into a map
+        operator std::string() const
+        {
+            return std::string(data, size);
+        }
+    };
+
+    /**
+     * The fast built-in hashers for integers and std::string. The results are already mixed (isMixed is true), so the maps
+     * using them skip the hash mixer by default
+     * */
+    template <typename T, typename Enable = void>
+    struct FastHash;
+
+    template <typename T>
+    struct FastHash<T, typename std::enable_if<std::is_integral<T>::value>::type>
+    {
+        static constexpr bool isMixed = true;
+        uint64_t operator()(T v) const
+        {
+            // Fibonacci hashing. The high bits of the product are well mixed, fold them to the low bits
+            uint64_t h = uint64_t(v) * 0x9e3779b97f4a7c15ULL;
+            return h ^ (h >> 29);
+        }
+    };
+
+    template <>
+    struct FastHash<std::string>
+    {
+        static constexpr bool isMixed = true;
+
+        static uint64_t hashBytes(const char *p, size_t len)
+        {
+            uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+            auto step = [&h](uint64_t w) {
+                h = (h ^ w) * 0xff51afd7ed558ccdULL;
+                h = (h << 31) | (h >> 33);
+            };
+            for (; len >= 8; p += 8, len -= 8)
+            {
+                uint64_t w;
+                memcpy(&w, p, 8);
+                step(w);
+            }
+            if (len)
+            {
+                uint64_t w = 0;
+                memcpy(&w, p, len);
+                step(w);
+            }
+            return MixMurmur::mix(h);
+        }
+
+        uint64_t operator()(const std::string &s) const
+        {
+            return hashBytes(s.data(), s.size());
+        }
+
+        // hashes a slice the same as the std::string holding the same bytes
+        typedef void is_transparent;
+        uint64_t operator()(StringSlice s) const
+        {
+            return hashBytes(s.data, s.size);
+        }
+
+        uint64_t operator()(const char *s) const
+        {
+            return hashBytes(s, strlen(s));
+        }
+    };
+
+    /**
+     * The transparent equality of std::string, StringSlice and C strings
+     * */
+    struct StringEqual
+    {
+        typedef void is_transparent;
+        bool operator()(StringSlice a, StringSlice b) const
+        {
+            return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+        }
+    };
+
+    template <typename T>
+    struct VoidOf
+    {
+        typedef void type;
+    };
+
+    /**
+     * A hasher or comparer is transparent if it defines the type is_transparent. The maps using a transparent Hasher and
+     * Comparer accept the keys of other types (like StringSlice for std::string) in the lookups, without constructing K
+     * */
+    template <typename T, typename Enable = void>
+    struct IsTransparent : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct IsTransparent<T, typename VoidOf<typename T::is_transparent>::type> : std::true_type
+    {
+    };
+
+    // selects MixNone for the hashers with isMixed = true, otherwise MixMurmur
+    template <typename Hasher, typename Enable = void>
+    struct DefaultMixer
+    {
+        typedef MixMurmur type;
+    };
+
+    template <typename Hasher>
+    struct DefaultMixer<Hasher, typename std::enable_if<Hasher::isMixed>::type>
+    {
+        typedef MixNone type;
+    };
+} // namespace Kuai
@@ -0,0 +1,114 @@
+#pragma once
+#include "SpinLock.hpp"
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+namespace Kuai
+{
+    struct HazardRecord;
+    /**
+     * The list of the hazard records of all threads. A removed node can be freed if no record holds a pointer to it
+     * */
+    struct HazardRegistry
+    {
+        SpinRWLock lock;
+        std::vector<HazardRecord *> records;
+        void add_record(HazardRecord *rec)
+        {
+            auto lk = lock.write();
+            std::lock_guard<SpinRWLock::WriteLock> guard(lk);
+            records.push_back(rec);
+        }
+
+        void remove_record(HazardRecord *rec)
+        {
+            auto lk = lock.write();
+            std::lock_guard<SpinRWLock::WriteLock> guard(lk);
+            for (auto itr = records.begin(); itr != records.end(); ++itr)
+            {
+                if (*itr == rec)
+                {
+                    records.erase(itr);
+                    break;
+                }
+            }
+        }
+
+        // get the sorted pointers held by all threads
+        void snapshot(std::vector<void *> &out);
+        static HazardRegistry registry;
+    };
+
+    /**
+     * The hazard pointers of a thread. A reader walking a list holds the current node in one slot and the next node in
+     * another one. An inserter also holds the head of the list which it will replace
+     * */
+    struct HazardRecord
+    {
+        static constexpr unsigned NUM_HAZARDS = 3;
+        std::atomic<void *> hazards[NUM_HAZARDS];
+        HazardRecord()
+        {
+            clear();
+            HazardRegistry::registry.add_record(this);
+        }
+        ~HazardRecord()
+        {
+            HazardRegistry::registry.remove_record(this);
+        }
+
+        void clear()
+        {
+            for (auto &h : hazards)
+            {
+                h.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Load the pointer in (src) and publish it in the slot. The pointer is protected if (src) still holds it after it
+         * is published. The caller should check that (src) itself is still reachable
+         * */
+        template <typename T>
+        T *protect(const std::atomic<T *> &src, unsigned slot)
+        {
+            T *p = src.load(std::memory_order_acquire);
+            for (;;)
+            {
+                // seq_cst orders the publication before the reload, pairing with the fence in the scan
+                hazards[slot].store(p, std::memory_order_seq_cst);
+                T *again = src.load(std::memory_order_acquire);
+                if (again == p)
+                {
+                    return p;
+                }
+                p = again;
+            }
+        }
+
+        static thread_local HazardRecord tls_record;
+    };
+
+    inline void HazardRegistry::snapshot(std::vector<void *> &out)
+    {
+        out.clear();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            auto lk = lock.read();
+            std::lock_guard<SpinRWLock::ReadLock> guard(lk);
+            for (auto rec : records)
+            {
+                for (auto &h : rec->hazards)
+                {
+                    void *p = h.load();
+                    if (p)
+                    {
+                        out.push_back(p);
+                    }
+                }
+            }
+        }
+        std::sort(out.begin(), out.end());
+    }
+} // namespace Kuai
@@ -3,12 +3,17 @@
 #include <utility>
 #include "SpinLock.hpp"
 #include <vector>
+#include <limits>
+#include <algorithm>
 namespace Kuai
 {
     struct ThreadClock;
     struct GlobalClock
     {
         std::atomic<uint64_t> logicalClock = {0};
+        // the min local clock of the threads found by the last GC pass. All threads have seen the events with logical tick
+        // less than or equal to it. It never decreases, since a new thread starts with the current global clock
+        std::atomic<uint64_t> safeEpoch = {0};
         SpinRWLock lock;
         std::vector<ThreadClock *> threads;
         void add_thread(ThreadClock *th)
@@ -33,12 +38,16 @@ namespace Kuai
         }
 
         uint64_t get_min_lock();
+        // scan the local clocks of the threads once and publish the min as the safe epoch
+        uint64_t update_safe_epoch();
         static GlobalClock clock;
     };
 
     struct ThreadClock
     {
         std::atomic<uint64_t> logicalClock = {GlobalClock::clock.logicalClock.load()};
+        // the nesting depth of the read sections of the thread. The local clock is not updated in a read section
+        unsigned readDepth = 0;
         ThreadClock()
         {
             GlobalClock::clock.add_thread(this);
@@ -51,7 +60,27 @@ namespace Kuai
         static thread_local ThreadClock tls_clock;
         static void updateLocalClock()
         {
-            tls_clock.logicalClock.store(GlobalClock::clock.logicalClock.load(), std::memory_order_relaxed);
+            auto &local = tls_clock;
+            if (!local.readDepth)
+            {
+                local.logicalClock.store(GlobalClock::clock.logicalClock.load(), std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Publish the local clock once for a read section. The nodes read in the section will not be freed until the
+         * outermost section is left
+         * */
+        static void enterReadSection()
+        {
+            updateLocalClock();
+            tls_clock.readDepth++;
+        }
+
+        static void leaveReadSection()
+        {
+            tls_clock.readDepth--;
+            updateLocalClock();
         }
     };
 
@@ -66,4 +95,19 @@ namespace Kuai
         }
         return ret;
     }
-} // namespace Kuai
\ No newline at end of file
+
+    inline uint64_t GlobalClock::update_safe_epoch()
+    {
+        uint64_t minv = get_min_lock();
+        uint64_t oldv = safeEpoch.load();
+        // no thread is registered
+        if (minv == std::numeric_limits<uint64_t>::max())
+        {
+            return oldv;
+        }
+        while (oldv < minv && !safeEpoch.compare_exchange_weak(oldv, minv))
+        {
+        }
+        return oldv < minv ? minv : oldv;
+    }
+} // namespace Kuai
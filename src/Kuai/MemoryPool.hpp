@@ -1,75 +1,296 @@
 #pragma once
 #include "ListNode.hpp"
+#include "SpinLock.hpp"
+#include "ThreadSlot.hpp"
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <cstddef>
+#include <new>
 namespace Kuai
 {
 
+    /**
+     * The alignment of the objects from (Allocator), which is Allocator::alignment, or alignof(std::max_align_t) if the
+     * allocator does not define it
+     * */
+    template <typename Allocator>
+    struct AllocatorAlignment
+    {
+        template <typename A>
+        static constexpr size_t get(decltype(A::alignment) *)
+        {
+            return A::alignment;
+        }
+        template <typename A>
+        static constexpr size_t get(...)
+        {
+            return alignof(std::max_align_t);
+        }
+        static constexpr size_t value = get<Allocator>(nullptr);
+    };
+
+    /**
+     * The allocator of fixed-sized objects which allocates them from the heap
+     * */
+    struct HeapAllocator
+    {
+        // the alignment of the objects. operator new in C++11 does not respect the over-aligned types
+        static constexpr size_t alignment = alignof(std::max_align_t);
+        uint64_t objSize;
+        HeapAllocator(uint64_t objSize) : objSize(objSize) {}
+
+        void *alloc()
+        {
+            return ::operator new(objSize);
+        }
+
+        void dealloc(void *ptr)
+        {
+            ::operator delete(ptr);
+        }
+    };
+
+    /**
+     * The allocator of fixed-sized objects. It allocates the objects in batch from a page of (allocSize) bytes. The objects
+     * are 8-byte aligned. The pages are freed when the pool is destroyed.
+     *
+     * Each thread caches at most (cacheSize) free objects in its own magazine. A thread allocates and frees the objects in
+     * its magazine without synchronization. An empty magazine is refilled with a batch of (cacheSize / 2) objects from the
+     * shared stack of batches, and half of a full magazine is spilled to the shared stack as a batch.
+     * */
     struct MemoryPool
     {
         using node_t = ListNode<char[0]>;
-        typename node_t::ptr_t head = {nullptr};
+        // the alignment of the objects. The maps using the pool check that their nodes need no more
+        static constexpr size_t alignment = 8;
+        // the top of the shared stack of batches. The first node of a batch holds the pointer to the next batch in its data
+        std::atomic<node_t *> head = {nullptr};
         uint64_t objSize;
         uint64_t allocSize;
+        uint32_t batchSize;
         node_t *pageList = nullptr;
-        constexpr static node_t *EMPTY_PTR = nullptr;
-        constexpr static node_t *LOCK_SUCCESS = (node_t *)1;
-        constexpr static node_t *ALLOCATING = (node_t *)2;
+        constexpr static uintptr_t EMPTY_PTR = 0;
+        // the sentinels in head, indicating that a thread is popping the stack or allocating a new page
+        constexpr static uintptr_t LOCK_SUCCESS = 1;
+        constexpr static uintptr_t ALLOCATING = 2;
+        constexpr static uint64_t DEFAULT_ALLOC_SIZE = 64 * 1024;
+        constexpr static uint32_t DEFAULT_CACHE_SIZE = 64;
 
-        void do_batch_alloc()
+        struct Magazine
         {
-            auto pageSize = allocSize + sizeof(node_t);
-            auto objNodeSize = objSize + sizeof(node_t);
-            node_t *newpage = (node_t *)malloc(pageSize);
+            node_t *list = nullptr;
+            uint32_t count = 0;
+            // avoid false sharing with the magazines of other threads
+            char padding[64 - sizeof(node_t *) - sizeof(uint32_t)];
+        };
+        // the magazines of the threads, indexed by ThreadSlot. Allocated when the thread first uses the pool
+        Magazine *magazines[ThreadSlot::MAX_SLOTS] = {nullptr};
+        // the magazine shared by the threads without a slot
+        Magazine sharedMagazine;
+        SpinLock sharedMagazineLock;
+
+        MemoryPool(uint64_t objSize, uint64_t allocSize = DEFAULT_ALLOC_SIZE, uint32_t cacheSize = DEFAULT_CACHE_SIZE)
+        {
+            // the objects in the shared stack should be able to hold the pointer to the next batch
+            this->objSize = objSize < sizeof(node_t *) ? sizeof(node_t *) : objSize;
+            batchSize = cacheSize < 2 ? 1 : cacheSize / 2;
+            // a page holds whole batches
+            auto batchBytes = objNodeSize() * batchSize;
+            this->allocSize = allocSize < batchBytes ? batchBytes : allocSize / batchBytes * batchBytes;
+        }
+        MemoryPool(const MemoryPool &) = delete;
+        MemoryPool(MemoryPool &&) = delete;
+
+        ~MemoryPool()
+        {
+            for (auto mag : magazines)
+            {
+                delete mag;
+            }
+            while (pageList)
+            {
+                auto next = pageList->next;
+                free(pageList);
+                pageList = next;
+            }
+        }
+
+        uint64_t objNodeSize() const
+        {
+            return (objSize + offsetof(node_t, data) + 7) / 8 * 8;
+        }
+
+        static bool isSentinel(node_t *p)
+        {
+            return (uintptr_t)p == LOCK_SUCCESS || (uintptr_t)p == ALLOCATING;
+        }
+
+        static node_t *&nextBatch(node_t *batch)
+        {
+            return *(node_t **)batch->data;
+        }
+
+        // allocate a new page and return the list of batches in it. The caller should have set head to ALLOCATING
+        node_t *do_batch_alloc()
+        {
+            auto nodeSize = objNodeSize();
+            node_t *newpage = (node_t *)malloc(allocSize + sizeof(node_t));
+            if (!newpage)
+            {
+                throw std::bad_alloc();
+            }
             newpage->next = pageList;
             pageList = newpage;
-            uintptr_t curObj = (uintptr_t)newpage->data;
-            while (curObj + objNodeSize <= (uintptr_t)newpage->data + allocSize)
+            auto numObj = allocSize / nodeSize;
+            node_t *list = nullptr;
+            node_t *batches = nullptr;
+            // link the objects in the order of their addresses
+            for (auto i = numObj; i > 0; i--)
             {
-                auto newhead = (node_t *)curObj;
-                newhead->next = head.load();
-                head = newhead;
-                curObj += objNodeSize;
+                auto newhead = (node_t *)((uintptr_t)newpage->data + (i - 1) * nodeSize);
+                newhead->next = list;
+                list = newhead;
+                if ((i - 1) % batchSize == 0)
+                {
+                    // cut the batch
+                    nextBatch(list) = batches;
+                    batches = list;
+                    list = nullptr;
+                }
             }
+            return batches;
         }
 
-        void *alloc()
+        // pop a batch of (batchSize) objects from the shared stack
+        node_t *popBatch()
         {
             node_t *cur;
             for (;;)
             {
                 cur = head.load();
-                if (cur == EMPTY_PTR)
+                if ((uintptr_t)cur == EMPTY_PTR)
                 {
-                    cur = ALLOCATING;
-                    if (head.compare_exchange_weak(cur, EMPTY_PTR))
+                    if (head.compare_exchange_weak(cur, (node_t *)ALLOCATING))
                     {
-                        do_batch_alloc();
+                        try
+                        {
+                            cur = do_batch_alloc();
+                        }
+                        catch (...)
+                        {
+                            head.store(nullptr);
+                            throw;
+                        }
+                        break;
                     }
                     continue;
                 }
-                else if (cur == ALLOCATING || cur == LOCK_SUCCESS)
+                else if (isSentinel(cur))
                 {
                     continue;
                 }
-                if (head.compare_exchange_weak(cur, LOCK_SUCCESS))
+                // "lock" the stack before popping, so that the next batch of cur will not be changed by other threads
+                if (head.compare_exchange_weak(cur, (node_t *)LOCK_SUCCESS))
                 {
                     break;
                 }
             }
-            void *ret = cur->data;
-            head = cur->next.load();
-            return ret;
+            head.store(nextBatch(cur));
+            return cur;
+        }
+
+        // push a batch of (batchSize) objects to the shared stack
+        void pushBatch(node_t *batch)
+        {
+            node_t *cur = head.load();
+            for (;;)
+            {
+                if (isSentinel(cur))
+                {
+                    cur = head.load();
+                    continue;
+                }
+                nextBatch(batch) = cur;
+                if (head.compare_exchange_weak(cur, batch))
+                {
+                    break;
+                }
+            }
+        }
+
+        void *allocFrom(Magazine &mag)
+        {
+            if (!mag.list)
+            {
+                mag.list = popBatch();
+                mag.count = batchSize;
+            }
+            node_t *cur = mag.list;
+            mag.list = cur->next;
+            mag.count--;
+            return cur->data;
+        }
+
+        void deallocTo(Magazine &mag, node_t *node)
+        {
+            if (mag.count >= batchSize * 2)
+            {
+                // spill the first half of the magazine
+                node_t *batch = mag.list;
+                node_t *last = batch;
+                for (uint32_t i = 1; i < batchSize; i++)
+                {
+                    last = last->next;
+                }
+                mag.list = last->next;
+                last->next = nullptr;
+                mag.count -= batchSize;
+                pushBatch(batch);
+            }
+            node->next = mag.list;
+            mag.list = node;
+            mag.count++;
+        }
+
+        Magazine *localMagazine()
+        {
+            unsigned id = ThreadSlot::tls_slot.id;
+            if (id == ThreadSlot::NO_SLOT)
+            {
+                return nullptr;
+            }
+            Magazine *mag = magazines[id];
+            if (!mag)
+            {
+                mag = new Magazine();
+                magazines[id] = mag;
+            }
+            return mag;
+        }
+
+        void *alloc()
+        {
+            Magazine *mag = localMagazine();
+            if (mag)
+            {
+                return allocFrom(*mag);
+            }
+            std::lock_guard<SpinLock> guard(sharedMagazineLock);
+            return allocFrom(sharedMagazine);
         }
 
         void dealloc(void *ptr)
         {
-            auto node = (node_t *)(uintptr_t(ptr) - sizeof(node_t::ptr_t));
-            node_t *cur;
-            do
+            auto node = (node_t *)((uintptr_t)ptr - offsetof(node_t, data));
+            Magazine *mag = localMagazine();
+            if (mag)
             {
-                cur = head.load();
-                node->next = cur;
-            } while (!head.compare_exchange_weak(node, cur));
+                deallocTo(*mag, node);
+                return;
+            }
+            std::lock_guard<SpinLock> guard(sharedMagazineLock);
+            deallocTo(sharedMagazine, node);
         }
     };
-} // namespace Kuai
\ No newline at end of file
+} // namespace Kuai
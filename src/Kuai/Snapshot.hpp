@@ -0,0 +1,245 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Kuai
+{
+    /**
+     * The snapshot file of a map starts with the header, followed by (count) records of the key and the value, in the
+     * order of the buckets. The keys and the values are written by SnapshotSerializer
+     * */
+    struct SnapshotHeader
+    {
+        static constexpr uint32_t VERSION = 1;
+        char magic[8];
+        uint32_t version;
+        // the sizes of the key and the value if they are fixed-sized, otherwise 0
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t reserved;
+        uint64_t count;
+
+        static const char *expectedMagic()
+        {
+            return "KUAISNAP";
+        }
+    };
+
+    /**
+     * The serializer of the keys and the values in the snapshots. The trivially copyable types are written as their bytes,
+     * and std::string as its length followed by its bytes. Other types can be supported by specializing it with:
+     *
+     * static constexpr bool fixedSize = false;
+     * // append the bytes of the value to (out)
+     * static void write(std::string &out, const T &v);
+     * // read a value from the buffer at (p) and advance (p). Throws if it runs over (end)
+     * static T read(const char *&p, const char *end);
+     * */
+    template <typename T, typename Enable = void>
+    struct SnapshotSerializer;
+
+    inline void snapshotWrite(std::string &out, const void *data, size_t size)
+    {
+        out.append((const char *)data, size);
+    }
+
+    inline const char *snapshotRead(const char *&p, const char *end, size_t size)
+    {
+        if (size_t(end - p) < size)
+        {
+            throw std::runtime_error("The snapshot is truncated");
+        }
+        const char *ret = p;
+        p += size;
+        return ret;
+    }
+
+    template <typename T>
+    struct SnapshotSerializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+    {
+        static constexpr bool fixedSize = true;
+        static void write(std::string &out, const T &v)
+        {
+            snapshotWrite(out, &v, sizeof(T));
+        }
+
+        static T read(const char *&p, const char *end)
+        {
+            T v;
+            memcpy(&v, snapshotRead(p, end, sizeof(T)), sizeof(T));
+            return v;
+        }
+    };
+
+    template <>
+    struct SnapshotSerializer<std::string>
+    {
+        static constexpr bool fixedSize = false;
+        static void write(std::string &out, const std::string &v)
+        {
+            uint64_t len = v.size();
+            snapshotWrite(out, &len, sizeof(len));
+            snapshotWrite(out, v.data(), v.size());
+        }
+
+        static std::string read(const char *&p, const char *end)
+        {
+            uint64_t len = SnapshotSerializer<uint64_t>::read(p, end);
+            const char *data = snapshotRead(p, end, len);
+            return std::string(data, len);
+        }
+    };
+
+    /**
+     * The random access iterator over the records of fixed-sized keys and values in a mapped snapshot, which can be passed
+     * to ConHashMap::bulkInsert(). A record is copied out when it is accessed, since the records are not aligned
+     * */
+    template <typename K, typename V>
+    struct SnapshotRecordIterator
+    {
+        static constexpr size_t RECORD_SIZE = sizeof(K) + sizeof(V);
+        struct Record
+        {
+            K first;
+            V second;
+        };
+        const char *p;
+
+        Record operator[](size_t i) const
+        {
+            Record r;
+            memcpy(&r.first, p + i * RECORD_SIZE, sizeof(K));
+            memcpy(&r.second, p + i * RECORD_SIZE + sizeof(K), sizeof(V));
+            return r;
+        }
+
+        ptrdiff_t operator-(const SnapshotRecordIterator &other) const
+        {
+            return (p - other.p) / ptrdiff_t(RECORD_SIZE);
+        }
+    };
+
+    /**
+     * The snapshot file being written. The records are buffered in (buffer) and written when it is full. The file is
+     * written at (path).tmp and renamed to (path) by finish(), so a save which fails or is interrupted leaves the previous
+     * file at (path). The temporary file of an unfinished save is deleted when the writer is destroyed. Throws if the file
+     * cannot be written
+     * */
+    struct SnapshotWriter
+    {
+        static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+        FILE *f;
+        std::string path;
+        std::string tmpPath;
+        std::string buffer;
+
+        SnapshotWriter(const char *path) : path(path), tmpPath(std::string(path) + ".tmp")
+        {
+            f = fopen(tmpPath.c_str(), "wb");
+            if (!f)
+            {
+                throw std::runtime_error("Cannot create the snapshot");
+            }
+            buffer.reserve(BUFFER_SIZE * 2);
+        }
+        SnapshotWriter(const SnapshotWriter &) = delete;
+
+        ~SnapshotWriter()
+        {
+            if (f)
+            {
+                fclose(f);
+                unlink(tmpPath.c_str());
+            }
+        }
+
+        void flush()
+        {
+            if (fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size())
+            {
+                throw std::runtime_error("Cannot write the snapshot");
+            }
+            buffer.clear();
+        }
+
+        void flushIfFull()
+        {
+            if (buffer.size() >= BUFFER_SIZE)
+            {
+                flush();
+            }
+        }
+
+        // write the header at the start of the file, close it and move it to (path)
+        void finish(const SnapshotHeader &header)
+        {
+            flush();
+            if (fseek(f, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, f) != 1 || fflush(f) || fsync(fileno(f)))
+            {
+                throw std::runtime_error("Cannot write the snapshot");
+            }
+            int ret = fclose(f);
+            f = nullptr;
+            if (ret || rename(tmpPath.c_str(), path.c_str()))
+            {
+                unlink(tmpPath.c_str());
+                throw std::runtime_error("Cannot write the snapshot");
+            }
+        }
+    };
+
+    /**
+     * The read-only mapping of a file. It is unmapped when destroyed
+     * */
+    struct MappedFile
+    {
+        const char *data = nullptr;
+        size_t size = 0;
+
+        MappedFile(const char *path)
+        {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Cannot open the snapshot");
+            }
+            struct stat st;
+            if (fstat(fd, &st) || st.st_size == 0)
+            {
+                close(fd);
+                throw std::runtime_error("Cannot read the snapshot");
+            }
+            size = st.st_size;
+#ifdef MAP_POPULATE
+            // prefault the pages, since the whole file is read by the loader
+            void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+            void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+            close(fd);
+            if (mem == MAP_FAILED)
+            {
+                throw std::runtime_error("Cannot map the snapshot");
+            }
+#ifndef MAP_POPULATE
+            // MAP_POPULATE is Linux-only. Ask for the readahead instead. It is only a hint, so the result is ignored
+            madvise(mem, size, MADV_WILLNEED);
+#endif
+            data = (const char *)mem;
+        }
+        MappedFile(const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            munmap((void *)data, size);
+        }
+    };
+} // namespace Kuai
@@ -1,19 +1,75 @@
 #pragma once
 #include <atomic>
 #include <mutex> //lock_guard
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 namespace Kuai
 {
+    // hint the CPU that we are spinning
+    inline void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /**
+     * Lock (lk) and return the number of the failed attempts before getting it, for counting the contention. The locks of
+     * Kuai provide lockSpins(), and other locks are counted as not contended
+     * */
+    template <typename Lock>
+    auto lockWithSpins(Lock &lk, int) -> decltype(uint64_t(lk.lockSpins()))
+    {
+        return lk.lockSpins();
+    }
+
+    template <typename Lock>
+    uint64_t lockWithSpins(Lock &lk, long)
+    {
+        lk.lock();
+        return 0;
+    }
+
+    template <typename Lock>
+    uint64_t lockWithSpins(Lock &lk)
+    {
+        return lockWithSpins(lk, 0);
+    }
 
     struct SpinLock
     {
         std::atomic<int> v = {0};
         void lock()
+        {
+            lockSpins();
+        }
+
+        // lock and return the number of the failed attempts
+        uint64_t lockSpins()
         {
             int oldv = 0;
+            uint64_t spins = 0;
             while (!v.compare_exchange_weak(oldv, 1))
             {
                 oldv = 0;
+                spins++;
             }
+            return spins;
+        }
+
+        bool try_lock()
+        {
+            int oldv = 0;
+            return v.compare_exchange_strong(oldv, 1);
         }
 
         void unlock()
@@ -25,6 +81,124 @@ namespace Kuai
         SpinLock(SpinLock &&) = delete;
     };
 
+    /**
+     * Test-and-test-and-set spin lock. The waiters spin on reading the lock word, which does not take the cache line away
+     * from the owner, and back off exponentially after each failed attempt
+     * */
+    struct TTASSpinLock
+    {
+        static constexpr unsigned MAX_BACKOFF = 1024;
+        std::atomic<int> v = {0};
+        void lock()
+        {
+            lockSpins();
+        }
+
+        uint64_t lockSpins()
+        {
+            unsigned backoff = 1;
+            uint64_t spins = 0;
+            while (!try_lock())
+            {
+                for (unsigned i = 0; i < backoff; i++)
+                {
+                    cpuRelax();
+                }
+                if (backoff < MAX_BACKOFF)
+                {
+                    backoff *= 2;
+                }
+                spins++;
+            }
+            return spins;
+        }
+
+        bool try_lock()
+        {
+            return !v.load(std::memory_order_relaxed) && !v.exchange(1, std::memory_order_acquire);
+        }
+
+        void unlock()
+        {
+            v.store(0, std::memory_order_release);
+        }
+        TTASSpinLock() = default;
+        TTASSpinLock(const TTASSpinLock &) = delete;
+        TTASSpinLock(TTASSpinLock &&) = delete;
+    };
+
+    /**
+     * Spins for a while and then sleeps on a futex, so that the waiters do not burn the CPU when the owner is preempted,
+     * e.g. when there are more threads than cores. The lock word is 0 when unlocked, 1 when locked, and 2 when locked and
+     * there may be sleeping waiters. On platforms without futex, the waiters yield instead of sleeping
+     * */
+    struct FutexLock
+    {
+        static constexpr unsigned SPIN_BUDGET = 128;
+        std::atomic<int> v = {0};
+        void lock()
+        {
+            lockSpins();
+        }
+
+        // lock and return the number of the failed attempts, including the wake-ups which did not get the lock
+        uint64_t lockSpins()
+        {
+            for (unsigned i = 0; i < SPIN_BUDGET; i++)
+            {
+                int oldv = v.load(std::memory_order_relaxed);
+                if (oldv == 0 && v.compare_exchange_weak(oldv, 1, std::memory_order_acquire))
+                {
+                    return i;
+                }
+                cpuRelax();
+            }
+            // we are going to sleep, mark the lock as contended so that the owner wakes us up
+            uint64_t spins = SPIN_BUDGET;
+            while (v.exchange(2, std::memory_order_acquire) != 0)
+            {
+                wait(2);
+                spins++;
+            }
+            return spins;
+        }
+
+        bool try_lock()
+        {
+            int oldv = 0;
+            return v.compare_exchange_strong(oldv, 1, std::memory_order_acquire);
+        }
+
+        void unlock()
+        {
+            if (v.exchange(0, std::memory_order_release) == 2)
+            {
+                wake();
+            }
+        }
+        FutexLock() = default;
+        FutexLock(const FutexLock &) = delete;
+        FutexLock(FutexLock &&) = delete;
+
+    private:
+        // sleep if the lock word is still (val)
+        void wait(int val)
+        {
+#ifdef __linux__
+            syscall(SYS_futex, (int *)&v, FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        void wake()
+        {
+#ifdef __linux__
+            syscall(SYS_futex, (int *)&v, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+        }
+    };
+
     struct SpinRWLock
     {
         std::atomic<int> readCount = {0};
@@ -0,0 +1,116 @@
+#pragma once
+#include "ThreadSlot.hpp"
+#include <stdint.h>
+#include <atomic>
+
+namespace Kuai
+{
+    /**
+     * The counters of the events in the bucket locks, the lookups and the deletion queue of a map, returned by
+     * ConHashMap::stats(). They are only counted when KUAI_STATS is defined before including Kuai, otherwise they are zeros
+     * */
+    struct StatCounters
+    {
+        enum Event
+        {
+            // the lock acquisitions which did not get the lock at the first attempt
+            LockContended,
+            // the failed attempts of the contended acquisitions
+            LockSpins,
+            // the lock-free lookups restarted because of meeting a removed node
+            FindRetries,
+            // the lock-free lookups restarted because the bucket was being split
+            SplitRetries,
+            NodesRetired,
+            NodesReclaimed,
+            GCPasses,
+            NUM_EVENTS
+        };
+#ifdef KUAI_STATS
+        static constexpr bool enabled = true;
+#else
+        static constexpr bool enabled = false;
+#endif
+
+        uint64_t lockContended = 0;
+        uint64_t lockSpins = 0;
+        uint64_t findRetries = 0;
+        uint64_t splitRetries = 0;
+        uint64_t nodesRetired = 0;
+        uint64_t nodesReclaimed = 0;
+        uint64_t gcPasses = 0;
+    };
+
+    /**
+     * The counters of one map, held by its deletion queue. Each thread counts in its own cache line, indexed by ThreadSlot,
+     * and the threads without a slot share the last one. Without KUAI_STATS, it is empty and count() does nothing.
+     * total() sums the counters of all threads, so it may miss the events being counted
+     * */
+    struct StatRecorder
+    {
+#ifdef KUAI_STATS
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> counts[StatCounters::NUM_EVENTS];
+            Slot()
+            {
+                for (auto &c : counts)
+                {
+                    c.store(0, std::memory_order_relaxed);
+                }
+            }
+        };
+        Slot slots[ThreadSlot::MAX_SLOTS + 1];
+#endif
+
+        void count(StatCounters::Event e, uint64_t n = 1)
+        {
+#ifdef KUAI_STATS
+            unsigned id = ThreadSlot::tls_slot.id;
+            auto &c = slots[id].counts[e];
+            if (id == ThreadSlot::NO_SLOT)
+            {
+                c.fetch_add(n, std::memory_order_relaxed);
+            }
+            else
+            {
+                // only the owner thread writes its counters
+                c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+#endif
+        }
+
+        // count a lock acquisition which failed (spins) attempts before getting the lock
+        void countLock(uint64_t spins)
+        {
+            if (spins)
+            {
+                count(StatCounters::LockContended);
+                count(StatCounters::LockSpins, spins);
+            }
+        }
+
+        StatCounters total() const
+        {
+            StatCounters ret;
+#ifdef KUAI_STATS
+            uint64_t sums[StatCounters::NUM_EVENTS] = {0};
+            for (auto &slot : slots)
+            {
+                for (int i = 0; i < StatCounters::NUM_EVENTS; i++)
+                {
+                    sums[i] += slot.counts[i].load(std::memory_order_relaxed);
+                }
+            }
+            ret.lockContended = sums[StatCounters::LockContended];
+            ret.lockSpins = sums[StatCounters::LockSpins];
+            ret.findRetries = sums[StatCounters::FindRetries];
+            ret.splitRetries = sums[StatCounters::SplitRetries];
+            ret.nodesRetired = sums[StatCounters::NodesRetired];
+            ret.nodesReclaimed = sums[StatCounters::NodesReclaimed];
+            ret.gcPasses = sums[StatCounters::GCPasses];
+#endif
+            return ret;
+        }
+    };
+} // namespace Kuai
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+namespace Kuai
+{
+    /**
+     * The index of the current thread. At most MAX_SLOTS threads have a slot at the same time, and the slot of an exited
+     * thread will be reused by a new thread. The threads without a slot get NO_SLOT
+     * */
+    struct ThreadSlot
+    {
+        static constexpr unsigned MAX_SLOTS = 128;
+        static constexpr unsigned NO_SLOT = MAX_SLOTS;
+        unsigned id;
+        ThreadSlot()
+        {
+            id = NO_SLOT;
+            for (unsigned i = 0; i < MAX_SLOTS / 64; i++)
+            {
+                uint64_t used = usedSlots[i].load();
+                while (~used)
+                {
+                    unsigned bit = __builtin_ctzll(~used);
+                    if (usedSlots[i].compare_exchange_weak(used, used | (uint64_t(1) << bit)))
+                    {
+                        id = i * 64 + bit;
+                        return;
+                    }
+                }
+            }
+        }
+        ~ThreadSlot()
+        {
+            if (id != NO_SLOT)
+            {
+                usedSlots[id / 64].fetch_and(~(uint64_t(1) << (id % 64)));
+            }
+        }
+
+        static std::atomic<uint64_t> usedSlots[MAX_SLOTS / 64];
+        static thread_local ThreadSlot tls_slot;
+    };
+} // namespace Kuai
@@ -1,11 +1,18 @@
 #include <Kuai/ConcurrentHashMap.hpp>
+#include <Kuai/FlatHashMap.hpp>
 #include <Kuai/Globals.hpp>
 #include <utility>
 #include <cassert>
 #include <thread>
 #include <chrono>
 #include <unordered_map>
+#include <string>
+#include <vector>
+#include <condition_variable>
 #include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <math.h>
 #ifdef BENCH_TBB
 #include "tbb/concurrent_hash_map.h"
 #endif
@@ -13,6 +20,75 @@ using namespace Kuai;
 
 using RemovableMap = ConHashMap<PolicyCanRemove, int, int>;
 using NonRemovableMap = ConHashMap<PolicyNoRemove, int, int>;
+using RemovablePoolMap = ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, MemoryPool>;
+using NonRemovablePoolMap = ConHashMap<PolicyNoRemove, int, int, std::hash<int>, std::equal_to<int>, MemoryPool>;
+using HazardPointerMap = ConHashMap<PolicyHazardPointer, int, int>;
+using RemovableStripedMap = ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixMurmur, LayoutStripedLock>;
+
+// starts with a small bucket number and grows when the keys are inserted
+template <typename T>
+struct GrowingMap : T
+{
+    GrowingMap(int size) : T(1024) {}
+};
+
+// inserts the new keys by CAS on the bucket heads
+template <typename T>
+struct LockFreeInsertMap : T
+{
+    LockFreeInsertMap(int size) : T(size)
+    {
+        this->setLockFreeInsert(true);
+    }
+};
+
+// FlatHashMap copies the value out. Returns the pointer to the copy, like the get() of other maps
+template <typename T>
+struct FlatMapAdapter : T
+{
+    FlatMapAdapter(int size) : T(size) {}
+    int *get(int k)
+    {
+        static thread_local int value;
+        return T::get(k, value) ? &value : nullptr;
+    }
+};
+using FlatRemovableMap = FlatMapAdapter<FlatHashMap<PolicyCanRemove, int, int>>;
+using FlatNonRemovableMap = FlatMapAdapter<FlatHashMap<PolicyNoRemove, int, int>>;
+
+// fills a map and freezes it when the loading is done. Only get() is supported after that
+template <typename T>
+struct FrozenMapAdapter
+{
+    T builder;
+    typename T::FrozenType frozen;
+    FrozenMapAdapter(int size) : builder(size) {}
+    void set(int k, int v)
+    {
+        builder.set(k, v);
+    }
+    const int *get(int k)
+    {
+        return frozen.get(k);
+    }
+    void finishLoading()
+    {
+        frozen = builder.freeze();
+    }
+};
+using FrozenNonRemovableMap = FrozenMapAdapter<NonRemovableMap>;
+
+// called when a test has filled the map, before the timed part
+template <typename T>
+void finishLoading(T &map)
+{
+}
+
+template <typename T>
+void finishLoading(FrozenMapAdapter<T> &map)
+{
+    map.finishLoading();
+}
 
 struct StdHashMap
 {
@@ -82,6 +158,7 @@ void same_entry_test(int num_iter, bool printit, int numthreads)
     map.set(0, 123);
     map.set(1, 123);
     map.set(2, 123);
+    finishLoading(map);
     auto thread_func = [&map, num_iter, printit]() {
         int sum = 0;
         for (int i = 0; i < num_iter; i++)
@@ -104,6 +181,41 @@ void same_entry_test(int num_iter, bool printit, int numthreads)
         printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
 }
 
+// like same_entry_test, but reads in read sections of (reads_per_guard) gets
+template <typename T>
+void same_entry_guard_test(int num_iter, bool printit, int numthreads)
+{
+    constexpr int reads_per_guard = 1024;
+    T map(1024);
+    map.set(0, 123);
+    map.set(1, 123);
+    map.set(2, 123);
+    auto thread_func = [&map, num_iter, printit]() {
+        int sum = 0;
+        for (int i = 0; i < num_iter; i += reads_per_guard)
+        {
+            typename T::ReadGuard guard(map);
+            for (int j = 0; j < reads_per_guard; j++)
+            {
+                sum += *guard.get(2);
+            }
+        }
+    };
+    std::thread threads[numthreads];
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func);
+    }
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
 void multi_thread_read_same_entry(int numthreads)
 {
     printf("******************\nSame entry performance\n");
@@ -112,10 +224,18 @@ void multi_thread_read_same_entry(int numthreads)
     same_entry_test<RemovableMap>(1000, false, numthreads);
     same_entry_test<RemovableMap>(num_iter, true, numthreads);
 
+    printf("====================\nRemovable, ReadGuard\n");
+    same_entry_guard_test<RemovableMap>(1000, false, numthreads);
+    same_entry_guard_test<RemovableMap>(num_iter, true, numthreads);
+
     printf("====================\nNonRemovable\n");
     same_entry_test<NonRemovableMap>(1000, false, numthreads);
     same_entry_test<NonRemovableMap>(num_iter, true, numthreads);
 
+    printf("====================\nFrozen\n");
+    same_entry_test<FrozenNonRemovableMap>(1000, false, numthreads);
+    same_entry_test<FrozenNonRemovableMap>(num_iter, true, numthreads);
+
     printf("====================\nstd::unordered_map\n");
     same_entry_test<StdHashMap>(1000, false, numthreads);
     same_entry_test<StdHashMap>(num_iter, true, numthreads);
@@ -131,6 +251,8 @@ uint32_t myrand(uint32_t &seed)
     return seed >> 4;
 }
 
+volatile int sink;
+
 template <typename T>
 void do_perf_test(int num_iter, int read_percent, bool printit, int numthreads)
 {
@@ -140,6 +262,7 @@ void do_perf_test(int num_iter, int read_percent, bool printit, int numthreads)
     {
         map.set(i, i);
     }
+    finishLoading(map);
     std::atomic<bool> startflag = {{false}};
     auto thread_func = [&map, num_iter, printit, read_percent, &startflag](uint32_t seed) {
         while (!startflag)
@@ -162,6 +285,8 @@ void do_perf_test(int num_iter, int read_percent, bool printit, int numthreads)
                 map.set(myrand(seed) % max_key, myrand(seed));
             }
         }
+        // keeps the reads of the maps with inlined get() from being optimized out
+        sink = sum;
     };
     std::thread threads[numthreads];
     for (int i = 0; i < numthreads; i++)
@@ -188,11 +313,35 @@ void perf_test(int read_percent, int numthreads)
     do_perf_test<RemovableMap>(1000, read_percent, false, numthreads);
     do_perf_test<RemovableMap>(num_iter, read_percent, true, numthreads);
 
+    printf("====================\nRemovable, hazard pointers\n");
+    do_perf_test<HazardPointerMap>(1000, read_percent, false, numthreads);
+    do_perf_test<HazardPointerMap>(num_iter, read_percent, true, numthreads);
+
+    printf("====================\nRemovable, growing from 1024 buckets\n");
+    do_perf_test<GrowingMap<RemovableMap>>(1000, read_percent, false, numthreads);
+    do_perf_test<GrowingMap<RemovableMap>>(num_iter, read_percent, true, numthreads);
+
+    printf("====================\nRemovable, growing from 1024 buckets, lock-free insert\n");
+    do_perf_test<LockFreeInsertMap<GrowingMap<RemovableMap>>>(1000, read_percent, false, numthreads);
+    do_perf_test<LockFreeInsertMap<GrowingMap<RemovableMap>>>(num_iter, read_percent, true, numthreads);
+
+    printf("====================\nRemovable, striped locks\n");
+    do_perf_test<RemovableStripedMap>(1000, read_percent, false, numthreads);
+    do_perf_test<RemovableStripedMap>(num_iter, read_percent, true, numthreads);
+
     printf("====================\nNonRemovable\n");
     do_perf_test<NonRemovableMap>(1000, read_percent, false, numthreads);
     do_perf_test<NonRemovableMap>(num_iter, read_percent, true, numthreads);
 
-    printf("====================\nstd::unordered_map\n");
+    printf("====================\nFlat, Removable\n");
+    do_perf_test<FlatRemovableMap>(1000, read_percent, false, numthreads);
+    do_perf_test<FlatRemovableMap>(num_iter, read_percent, true, numthreads);
+
+    printf("====================\nFlat, NonRemovable\n");
+    do_perf_test<FlatNonRemovableMap>(1000, read_percent, false, numthreads);
+    do_perf_test<FlatNonRemovableMap>(num_iter, read_percent, true, numthreads);
+
+    printf("====================\nstd::unordered_map with RWLock\n");
     do_perf_test<StdHashMapLocked>(1000, read_percent, false, numthreads);
     do_perf_test<StdHashMapLocked>(num_iter, read_percent, true, numthreads);
 
@@ -203,10 +352,1054 @@ void perf_test(int read_percent, int numthreads)
 #endif
     if (read_percent == 100)
     {
-        printf("====================\nstd::unordered_map\n");
-        do_perf_test<StdHashMapLocked>(1000, read_percent, false, numthreads);
-        do_perf_test<StdHashMapLocked>(num_iter, read_percent, true, numthreads);
+        printf("====================\nFrozen\n");
+        do_perf_test<FrozenNonRemovableMap>(1000, read_percent, false, numthreads);
+        do_perf_test<FrozenNonRemovableMap>(num_iter, read_percent, true, numthreads);
+
+        // the unlocked map is only safe when there are no writers
+        printf("====================\nstd::unordered_map (no lock)\n");
+        do_perf_test<StdHashMap>(1000, read_percent, false, numthreads);
+        do_perf_test<StdHashMap>(num_iter, read_percent, true, numthreads);
+    }
+}
+
+// each thread inserts distinct keys into the map
+template <typename T>
+void do_insert_test(int num_keys, bool printit, int numthreads)
+{
+    T map(1024 * 1024);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_keys, numthreads, &startflag](int tid) {
+        while (!startflag)
+            ;
+        for (int i = tid; i < num_keys; i += numthreads)
+        {
+            map.set(i, i);
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void insert_test(int numthreads)
+{
+    printf("******************\nInsert test\n");
+    int num_keys = 1000000;
+    printf("====================\nRemovable\n");
+    do_insert_test<RemovableMap>(1000, false, numthreads);
+    do_insert_test<RemovableMap>(num_keys, true, numthreads);
+
+    printf("====================\nRemovable, lock-free insert\n");
+    do_insert_test<LockFreeInsertMap<RemovableMap>>(1000, false, numthreads);
+    do_insert_test<LockFreeInsertMap<RemovableMap>>(num_keys, true, numthreads);
+
+    printf("====================\nRemovable, growing from 1024 buckets\n");
+    do_insert_test<GrowingMap<RemovableMap>>(1000, false, numthreads);
+    do_insert_test<GrowingMap<RemovableMap>>(num_keys, true, numthreads);
+
+    printf("====================\nRemovable, growing from 1024 buckets, lock-free insert\n");
+    do_insert_test<LockFreeInsertMap<GrowingMap<RemovableMap>>>(1000, false, numthreads);
+    do_insert_test<LockFreeInsertMap<GrowingMap<RemovableMap>>>(num_keys, true, numthreads);
+
+    printf("====================\nRemovable with MemoryPool\n");
+    do_insert_test<RemovablePoolMap>(1000, false, numthreads);
+    do_insert_test<RemovablePoolMap>(num_keys, true, numthreads);
+
+    printf("====================\nNonRemovable\n");
+    do_insert_test<NonRemovableMap>(1000, false, numthreads);
+    do_insert_test<NonRemovableMap>(num_keys, true, numthreads);
+
+    printf("====================\nNonRemovable with MemoryPool\n");
+    do_insert_test<NonRemovablePoolMap>(1000, false, numthreads);
+    do_insert_test<NonRemovablePoolMap>(num_keys, true, numthreads);
+}
+
+// reads the keys with a long common prefix, from the buckets holding (load_factor) keys on average
+template <typename T>
+void do_string_key_test(int num_iter, int load_factor, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 64;
+    T map(num_keys / load_factor);
+    map.setMaxLoadFactor(load_factor);
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++)
+    {
+        keys.push_back("/usr/local/share/kuai/benchmark/keys/" + std::to_string(i));
+        map.set(keys.back(), i);
+    }
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, &keys, num_iter, num_keys, &startflag](uint32_t seed) {
+        while (!startflag)
+            ;
+        int sum = 0;
+        for (int i = 0; i < num_iter; i++)
+        {
+            auto val = map.get(keys[myrand(seed) % num_keys]);
+            if (val)
+            {
+                sum += *val;
+            }
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void string_key_test(int numthreads)
+{
+    printf("******************\nString key test\n");
+    int num_iter = 1000000;
+    using StringMap = ConHashMap<PolicyNoRemove, std::string, int>;
+    for (int load_factor : {1, 8})
+    {
+        printf("====================\nNonRemovable, load factor = %d\n", load_factor);
+        do_string_key_test<StringMap>(1000, load_factor, false, numthreads);
+        do_string_key_test<StringMap>(num_iter, load_factor, true, numthreads);
+    }
+}
+
+enum StringInsertMode
+{
+    INSERT_COPY,
+    INSERT_MOVE,
+    INSERT_EMPLACE,
+};
+
+// each thread inserts its own std::string keys with std::string values of 64 chars
+void do_string_insert_test(int num_keys, StringInsertMode mode, bool printit, int numthreads)
+{
+    using StringValueMap = ConHashMap<PolicyNoRemove, std::string, std::string>;
+    StringValueMap map(num_keys);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_keys, mode, numthreads, &startflag](int tid) {
+        while (!startflag)
+            ;
+        for (int i = tid; i < num_keys; i += numthreads)
+        {
+            std::string key = "a string key with a long common prefix " + std::to_string(i);
+            switch (mode)
+            {
+            case INSERT_COPY:
+                map.set(key, std::string(64, 'v'));
+                break;
+            case INSERT_MOVE:
+                map.set(std::move(key), std::string(64, 'v'));
+                break;
+            case INSERT_EMPLACE:
+                map.emplace(std::move(key), 64, 'v');
+                break;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void string_insert_test(int numthreads)
+{
+    printf("******************\nString insert test\n");
+    int num_keys = 1000000;
+    printf("====================\nset, copying the key\n");
+    do_string_insert_test(1000, INSERT_COPY, false, numthreads);
+    do_string_insert_test(num_keys, INSERT_COPY, true, numthreads);
+
+    printf("====================\nset, moving the key\n");
+    do_string_insert_test(1000, INSERT_MOVE, false, numthreads);
+    do_string_insert_test(num_keys, INSERT_MOVE, true, numthreads);
+
+    printf("====================\nemplace\n");
+    do_string_insert_test(1000, INSERT_EMPLACE, false, numthreads);
+    do_string_insert_test(num_keys, INSERT_EMPLACE, true, numthreads);
+}
+
+// reads the keys which are multiples of 4096. They are in a few buckets if the low bits of the hash are not mixed
+template <typename T>
+void do_strided_key_test(int num_iter, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 64;
+    T map(1024 * 1024);
+    for (int i = 0; i < num_keys; i++)
+    {
+        map.set(i * 4096, i);
+    }
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, num_keys, &startflag](uint32_t seed) {
+        while (!startflag)
+            ;
+        int sum = 0;
+        for (int i = 0; i < num_iter; i++)
+        {
+            auto val = map.get(int(myrand(seed) % num_keys) * 4096);
+            if (val)
+            {
+                sum += *val;
+            }
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void hash_test(int numthreads)
+{
+    printf("******************\nStrided key test\n");
+    int num_iter = 500000;
+    printf("====================\nstd::hash, no mixing\n");
+    using UnmixedMap = ConHashMap<PolicyNoRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixNone>;
+    do_strided_key_test<UnmixedMap>(1000, false, numthreads);
+    do_strided_key_test<UnmixedMap>(num_iter, true, numthreads);
+
+    printf("====================\nstd::hash, MixMurmur\n");
+    do_strided_key_test<NonRemovableMap>(1000, false, numthreads);
+    do_strided_key_test<NonRemovableMap>(num_iter, true, numthreads);
+
+    printf("====================\nFastHash\n");
+    using FastHashMap = ConHashMap<PolicyNoRemove, int, int, FastHash<int>>;
+    do_strided_key_test<FastHashMap>(1000, false, numthreads);
+    do_strided_key_test<FastHashMap>(num_iter, true, numthreads);
+
+    printf("******************\nString key test with FastHash\n");
+    using FastStringMap = ConHashMap<PolicyNoRemove, std::string, int, FastHash<std::string>>;
+    for (int load_factor : {1, 8})
+    {
+        printf("====================\nNonRemovable, load factor = %d\n", load_factor);
+        do_string_key_test<FastStringMap>(1000, load_factor, false, numthreads);
+        do_string_key_test<FastStringMap>(1000000, load_factor, true, numthreads);
+    }
+}
+
+// reads the random keys in a map larger than the cache, (batch) keys at a time. Uses getBatch if (use_batch)
+template <typename T>
+void do_batch_get_test(int num_iter, int batch, bool use_batch, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 1024 * 4;
+    T map(num_keys);
+    for (int i = 0; i < num_keys; i++)
+    {
+        map.set(i, i);
+    }
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, num_keys, batch, use_batch, &startflag](uint32_t seed) {
+        std::vector<int> keys(batch);
+        std::vector<int *> out(batch);
+        while (!startflag)
+            ;
+        int sum = 0;
+        for (int i = 0; i < num_iter; i += batch)
+        {
+            for (auto &k : keys)
+            {
+                k = myrand(seed) % num_keys;
+            }
+            if (use_batch)
+            {
+                map.getBatch(keys.data(), batch, out.data());
+            }
+            else
+            {
+                for (int j = 0; j < batch; j++)
+                {
+                    out[j] = map.get(keys[j]);
+                }
+            }
+            for (auto val : out)
+            {
+                if (val)
+                {
+                    sum += *val;
+                }
+            }
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func, i);
     }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void batch_get_test(int numthreads)
+{
+    printf("******************\nBatch get test, 100 keys per batch\n");
+    int num_iter = 1000000;
+    printf("====================\nRemovable, get\n");
+    do_batch_get_test<RemovableMap>(num_iter, 100, false, true, numthreads);
+    printf("====================\nRemovable, getBatch\n");
+    do_batch_get_test<RemovableMap>(num_iter, 100, true, true, numthreads);
+    printf("====================\nNonRemovable, get\n");
+    do_batch_get_test<NonRemovableMap>(num_iter, 100, false, true, numthreads);
+    printf("====================\nNonRemovable, getBatch\n");
+    do_batch_get_test<NonRemovableMap>(num_iter, 100, true, true, numthreads);
+}
+
+/**
+ * Half of the threads read the even keys, and the others keep updating the odd keys. Without hash mixing, key i is in
+ * bucket i, so the readers and the writers use different buckets in the same cache lines. Measures the time of the readers
+ * */
+template <typename T>
+void do_false_sharing_test(int num_iter, bool printit, int numthreads)
+{
+    // many more buckets than the lock stripes, so each stripe is shared by the buckets of readers and writers
+    const int num_keys = 64 * 1024;
+    T map(num_keys);
+    for (int i = 0; i < num_keys; i++)
+    {
+        map.set(i, i);
+    }
+    int numreaders = numthreads > 1 ? numthreads / 2 : 1;
+    std::atomic<bool> startflag = {{false}};
+    std::atomic<int> running_readers = {numreaders};
+    auto reader_func = [&map, num_iter, num_keys, &startflag, &running_readers](uint32_t seed) {
+        while (!startflag)
+            ;
+        int sum = 0;
+        for (int i = 0; i < num_iter; i++)
+        {
+            sum += *map.get(myrand(seed) % num_keys & ~1);
+        }
+        --running_readers;
+    };
+    auto writer_func = [&map, num_keys, &startflag, &running_readers](uint32_t seed) {
+        while (!startflag)
+            ;
+        while (running_readers)
+        {
+            map.set(myrand(seed) % num_keys | 1, seed);
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = i < numreaders ? std::thread(reader_func, i) : std::thread(writer_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numreaders; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    for (int i = numreaders; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void false_sharing_test(int numthreads)
+{
+    printf("******************\nFalse sharing test\n");
+    int num_iter = 5000000;
+    using InlineMap = ConHashMap<PolicyNoRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixNone, LayoutInlineLock>;
+    using StripedMap = ConHashMap<PolicyNoRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixNone, LayoutStripedLock>;
+    printf("====================\nNonRemovable, inline locks\n");
+    do_false_sharing_test<InlineMap>(1000, false, numthreads);
+    do_false_sharing_test<InlineMap>(num_iter, true, numthreads);
+
+    printf("====================\nNonRemovable, striped locks\n");
+    do_false_sharing_test<StripedMap>(1000, false, numthreads);
+    do_false_sharing_test<StripedMap>(num_iter, true, numthreads);
+}
+
+// all threads update a few hot keys, with (numthreads) possibly more than the cores
+template <typename T>
+void do_hot_key_test(int num_iter, bool printit, int numthreads)
+{
+    const int num_keys = 16;
+    T map(num_keys);
+    for (int i = 0; i < num_keys; i++)
+    {
+        map.set(i, i);
+    }
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, num_keys, &startflag](uint32_t seed) {
+        while (!startflag)
+            ;
+        for (int i = 0; i < num_iter; i++)
+        {
+            map.set(myrand(seed) % num_keys, i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+template <typename LockT>
+using HotKeyMap = ConHashMap<PolicyNoRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixMurmur, LayoutInlineLock, LockT>;
+
+void lock_test(int numthreads)
+{
+    int cores = std::thread::hardware_concurrency();
+    for (int threads : {numthreads, cores * 8})
+    {
+        printf("******************\nHot key test, %d threads on %d cores\n", threads, cores);
+        int num_iter = 4000000 / threads;
+        printf("====================\nSpinLock\n");
+        do_hot_key_test<HotKeyMap<SpinLock>>(1000, false, threads);
+        do_hot_key_test<HotKeyMap<SpinLock>>(num_iter, true, threads);
+
+        printf("====================\nTTASSpinLock\n");
+        do_hot_key_test<HotKeyMap<TTASSpinLock>>(1000, false, threads);
+        do_hot_key_test<HotKeyMap<TTASSpinLock>>(num_iter, true, threads);
+
+        printf("====================\nFutexLock\n");
+        do_hot_key_test<HotKeyMap<FutexLock>>(1000, false, threads);
+        do_hot_key_test<HotKeyMap<FutexLock>>(num_iter, true, threads);
+    }
+}
+
+// each thread counts random keys. With (use_compute), the count is updated by compute(). Otherwise by get() and set(),
+// which walk the bucket twice and may lose the updates of other threads
+template <typename T>
+void do_counter_test(int num_iter, bool use_compute, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 64;
+    T map(num_keys);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, use_compute, num_keys, &startflag](uint32_t seed) {
+        while (!startflag)
+            ;
+        for (int i = 0; i < num_iter; i++)
+        {
+            int k = myrand(seed) % num_keys;
+            if (use_compute)
+            {
+                map.compute(k, [](int &v, bool found) { v++; });
+            }
+            else
+            {
+                auto v = map.get(k);
+                map.set(k, v ? *v + 1 : 1);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void counter_test(int numthreads)
+{
+    printf("******************\nCounter test\n");
+    int num_iter = 1000000;
+    printf("====================\nget + set\n");
+    do_counter_test<RemovableMap>(1000, false, false, numthreads);
+    do_counter_test<RemovableMap>(num_iter, false, true, numthreads);
+
+    printf("====================\ncompute\n");
+    do_counter_test<RemovableMap>(1000, true, false, numthreads);
+    do_counter_test<RemovableMap>(num_iter, true, true, numthreads);
+}
+
+using CounterMap = ConHashMap<PolicyCanRemove, int, uint64_t>;
+
+// counts the "words" drawn from a skewed distribution: key k has the probability about 1 / (k + 1), so a few hot keys
+// take most of the counts. With (use_increment), the count is updated by increment(). Otherwise by compute()
+void do_word_count_test(int num_iter, bool use_increment, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 64;
+    std::vector<int> words(num_iter);
+    uint32_t seed = 1;
+    for (auto &w : words)
+    {
+        // log-uniform over [0, num_keys)
+        double u = double(myrand(seed) % (1 << 24)) / (1 << 24);
+        w = int(pow(double(num_keys), u)) - 1;
+    }
+    CounterMap map(num_keys);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, &words, use_increment, numthreads, &startflag](int tid) {
+        while (!startflag)
+            ;
+        for (size_t i = tid; i < words.size(); i += numthreads)
+        {
+            if (use_increment)
+            {
+                map.increment(words[i]);
+            }
+            else
+            {
+                map.compute(words[i], [](uint64_t &v, bool found) { v++; });
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void word_count_test(int numthreads)
+{
+    printf("******************\nWord count test\n");
+    int num_iter = 4000000;
+    printf("====================\ncompute\n");
+    do_word_count_test(1000, false, false, numthreads);
+    do_word_count_test(num_iter, false, true, numthreads);
+
+    printf("====================\nincrement\n");
+    do_word_count_test(1000, true, false, numthreads);
+    do_word_count_test(num_iter, true, true, numthreads);
+}
+
+using SliceMap = ConHashMap<PolicyNoRemove, std::string, int, FastHash<std::string>, StringEqual>;
+
+// looks up the space-separated tokens of a text buffer, as a parser looking up the identifiers would do. With
+// (use_slice), the tokens are looked up as StringSlice. Otherwise a std::string is constructed for each token. The
+// identifiers are longer than the small string buffer of std::string, so each std::string allocates
+void do_parse_test(int num_iter, bool use_slice, bool printit, int numthreads)
+{
+    const int num_keys = 1024 * 16;
+    SliceMap map(num_keys);
+    std::vector<std::string> idents;
+    for (int i = 0; i < num_keys; i++)
+    {
+        idents.push_back("identifier_" + std::to_string(i) + "_of_the_parser");
+        map.set(idents.back(), i);
+    }
+    std::string text;
+    uint32_t seed = 1;
+    for (int i = 0; i < num_iter; i++)
+    {
+        text += idents[myrand(seed) % num_keys];
+        text += ' ';
+    }
+    std::atomic<bool> startflag = {{false}};
+    std::atomic<uint64_t> total = {0};
+    auto thread_func = [&map, &text, use_slice, numthreads, &startflag, &total](int tid) {
+        while (!startflag)
+            ;
+        // each thread parses a part of the buffer, starting from a token boundary
+        size_t begin = text.size() / numthreads * tid;
+        size_t end = text.size() / numthreads * (tid + 1);
+        const char *p = text.data();
+        while (begin > 0 && p[begin - 1] != ' ')
+            begin++;
+        while (end < text.size() && p[end - 1] != ' ')
+            end++;
+        uint64_t sum = 0;
+        for (size_t i = begin; i < end;)
+        {
+            size_t len = 0;
+            while (p[i + len] != ' ')
+                len++;
+            int *v = use_slice ? map.get(StringSlice(p + i, len)) : map.get(std::string(p + i, len));
+            sum += *v;
+            i += len + 1;
+        }
+        total += sum;
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void parse_test(int numthreads)
+{
+    printf("******************\nParse test\n");
+    int num_iter = 4000000;
+    printf("====================\nstd::string key\n");
+    do_parse_test(1000, false, false, numthreads);
+    do_parse_test(num_iter, false, true, numthreads);
+
+    printf("====================\nStringSlice key\n");
+    do_parse_test(1000, true, false, numthreads);
+    do_parse_test(num_iter, true, true, numthreads);
+}
+
+// sums the values of a map of (num_keys) keys by the Iterator, or by parallelForEach in (numthreads) threads
+void do_foreach_test(int num_keys, bool parallel, bool printit, int numthreads)
+{
+    RemovableMap map(num_keys);
+    for (int i = 0; i < num_keys; i++)
+    {
+        map.set(i, 1);
+    }
+    std::atomic<uint64_t> sum = {0};
+    auto start = std::chrono::high_resolution_clock::now();
+    if (parallel)
+    {
+        map.parallelForEach([&sum](const int &k, int &v) { sum.fetch_add(v, std::memory_order_relaxed); }, numthreads);
+    }
+    else
+    {
+        uint64_t localSum = 0;
+        for (RemovableMap::Iterator itr(map); itr.valid(); itr.next())
+        {
+            localSum += itr.value();
+        }
+        sum = localSum;
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (sum != uint64_t(num_keys))
+    {
+        printf("Bad sum %lu\n", (unsigned long)sum.load());
+    }
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void foreach_test(int numthreads)
+{
+    printf("******************\nForEach test\n");
+    int num_keys = 1024 * 1024 * 8;
+    printf("====================\nIterator\n");
+    do_foreach_test(1000, false, false, numthreads);
+    do_foreach_test(num_keys, false, true, numthreads);
+
+    printf("====================\nparallelForEach\n");
+    do_foreach_test(1000, true, false, numthreads);
+    do_foreach_test(num_keys, true, true, numthreads);
+}
+
+// fills a map of (num_keys) keys as the prefill loop of do_perf_test, or by bulkInsert in (numthreads) threads
+template <typename T>
+void do_bulk_insert_test(int num_keys, bool bulk, bool printit, int numthreads)
+{
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < num_keys; i++)
+    {
+        items.emplace_back(i, i);
+    }
+    T map(1024);
+    auto start = std::chrono::high_resolution_clock::now();
+    if (bulk)
+    {
+        map.bulkInsert(items.begin(), items.end(), numthreads);
+    }
+    else
+    {
+        for (auto &item : items)
+        {
+            map.set(item.first, item.second);
+        }
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void bulk_insert_test(int numthreads)
+{
+    printf("******************\nBulk insert test\n");
+    int num_keys = 1024 * 1024 * 2;
+    printf("====================\nset\n");
+    do_bulk_insert_test<RemovableMap>(1000, false, false, numthreads);
+    do_bulk_insert_test<RemovableMap>(num_keys, false, true, numthreads);
+
+    printf("====================\nbulkInsert\n");
+    do_bulk_insert_test<RemovableMap>(1000, true, false, numthreads);
+    do_bulk_insert_test<RemovableMap>(num_keys, true, true, numthreads);
+
+    printf("====================\nbulkInsert with MemoryPool\n");
+    do_bulk_insert_test<RemovablePoolMap>(1000, true, false, numthreads);
+    do_bulk_insert_test<RemovablePoolMap>(num_keys, true, true, numthreads);
+}
+
+// rebuilds a map of (num_keys) keys by the set loop, or from a snapshot by loadSnapshot in (numthreads) threads
+void do_snapshot_test(int num_keys, bool from_snapshot, bool printit, int numthreads)
+{
+    std::string path = "/tmp/kuai_snapshot_bench_" + std::to_string(getpid());
+    {
+        RemovableMap map(num_keys);
+        for (int i = 0; i < num_keys; i++)
+        {
+            map.set(i, i);
+        }
+        map.saveSnapshot(path.c_str());
+    }
+    RemovableMap map(1024);
+    auto start = std::chrono::high_resolution_clock::now();
+    if (from_snapshot)
+    {
+        map.loadSnapshot(path.c_str(), numthreads);
+    }
+    else
+    {
+        for (int i = 0; i < num_keys; i++)
+        {
+            map.set(i, i);
+        }
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    remove(path.c_str());
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void snapshot_test(int numthreads)
+{
+    printf("******************\nSnapshot test\n");
+    int num_keys = 1024 * 1024 * 2;
+    printf("====================\nset\n");
+    do_snapshot_test(1000, false, false, numthreads);
+    do_snapshot_test(num_keys, false, true, numthreads);
+
+    printf("====================\nloadSnapshot\n");
+    do_snapshot_test(1000, true, false, numthreads);
+    do_snapshot_test(num_keys, true, true, numthreads);
+}
+
+// each thread inserts and removes its own keys. Thread 0 also collects the garbage periodically
+template <typename T>
+void do_remove_test(int num_iter, bool printit, int numthreads)
+{
+    T map(1024 * 64);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, numthreads, &startflag](int tid) {
+        while (!startflag)
+            ;
+        for (int i = 0; i < num_iter; i++)
+        {
+            int k = (i % 4096) * numthreads + tid;
+            map.set(k, i);
+            map.remove(k);
+            if (tid == 0 && i % 10000 == 0)
+            {
+                map.garbageCollect();
+            }
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    map.garbageCollect();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void remove_test(int numthreads)
+{
+    printf("******************\nRemove test\n");
+    int num_iter = 500000;
+    printf("====================\nRemovable\n");
+    do_remove_test<RemovableMap>(1000, false, numthreads);
+    do_remove_test<RemovableMap>(num_iter, true, numthreads);
+
+    printf("====================\nRemovable, hazard pointers\n");
+    do_remove_test<HazardPointerMap>(1000, false, numthreads);
+    do_remove_test<HazardPointerMap>(num_iter, true, numthreads);
+
+    printf("====================\nRemovable with MemoryPool\n");
+    do_remove_test<RemovablePoolMap>(1000, false, numthreads);
+    do_remove_test<RemovablePoolMap>(num_iter, true, numthreads);
+}
+
+// measures garbageCollect() over (num_removed) removed nodes, with (num_idle) more threads registered in the global clock
+void do_gc_test(int num_removed, int num_idle)
+{
+    RemovableMap map(num_removed);
+    for (int i = 0; i < num_removed; i++)
+    {
+        map.set(i, i);
+    }
+    for (int i = 0; i < num_removed; i++)
+    {
+        map.remove(i);
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+    int acked = 0;
+    std::vector<std::thread> idlers;
+    for (int i = 0; i < num_idle; i++)
+    {
+        // updates the local clock after the removals and waits until the test is done
+        idlers.emplace_back([&]() {
+            PolicyCanRemove::updateLocalClock();
+            std::unique_lock<std::mutex> guard(mtx);
+            acked++;
+            cv.notify_all();
+            cv.wait(guard, [&]() { return done; });
+        });
+    }
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        cv.wait(guard, [&]() { return acked == num_idle; });
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    map.garbageCollect();
+    auto endt = std::chrono::high_resolution_clock::now();
+    printf("removed=%d, threads=%d, TIME= %ld us\n", num_removed, num_idle + 1,
+           std::chrono::duration_cast<std::chrono::microseconds>(endt - start).count());
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        done = true;
+        cv.notify_all();
+    }
+    for (auto &th : idlers)
+    {
+        th.join();
+    }
+}
+
+void gc_test()
+{
+    printf("******************\nGC test\n");
+    for (int num_removed : {10000, 100000})
+    {
+        for (int num_idle : {0, 15, 63})
+        {
+            do_gc_test(num_removed, num_idle);
+        }
+    }
+}
+
+// the resident set size of the process in KB
+long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+enum ReclaimMode
+{
+    RECLAIM_THRESHOLD,
+    RECLAIM_BACKGROUND,
+    RECLAIM_NONE,
+};
+
+// each thread inserts and removes its own keys without calling garbageCollect(). Prints the time and the growth of RSS
+void do_churn_test(ReclaimMode mode, int num_iter, int numthreads)
+{
+    long rssBefore = rss_kb();
+    RemovableMap map(1024 * 64);
+    if (mode == RECLAIM_THRESHOLD)
+    {
+        map.setReclaimThreshold(1024, 16 * 1024 * 1024);
+    }
+    else if (mode == RECLAIM_BACKGROUND)
+    {
+        map.startReclaimer(std::chrono::milliseconds(10));
+    }
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&map, num_iter, numthreads, &startflag](int tid) {
+        while (!startflag)
+            ;
+        for (int i = 0; i < num_iter; i++)
+        {
+            int k = (i % 4096) * numthreads + tid;
+            map.set(k, i);
+            map.remove(k);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads.emplace_back(thread_func, i);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    printf("pending=%zu, RSS growth=%ld KB, TIME= %ld ms\n", map.pendingRemoved(), rss_kb() - rssBefore,
+           std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void churn_test(int numthreads)
+{
+    constexpr int num_iter = 1000000;
+    printf("******************\nChurn test\n");
+    // the bounded modes go first, since the memory freed by the map is reused by the later tests
+    printf("====================\nReclaim threshold\n");
+    do_churn_test(RECLAIM_THRESHOLD, num_iter, numthreads);
+    printf("====================\nBackground reclaimer\n");
+    do_churn_test(RECLAIM_BACKGROUND, num_iter, numthreads);
+    printf("====================\nNo GC\n");
+    do_churn_test(RECLAIM_NONE, num_iter, numthreads);
+}
+
+// a MemoryPool with the magazines too small to cache a batch, so that each alloc/free goes to the shared stack
+struct UncachedMemoryPool : MemoryPool
+{
+    UncachedMemoryPool(uint64_t objSize) : MemoryPool(objSize, DEFAULT_ALLOC_SIZE, 1) {}
+};
+
+struct DefaultMemoryPool : MemoryPool
+{
+    DefaultMemoryPool(uint64_t objSize) : MemoryPool(objSize) {}
+};
+
+// each thread keeps a window of allocated objects and frees the oldest one before each allocation
+template <typename T>
+void do_alloc_test(int num_iter, bool printit, int numthreads)
+{
+    T allocator(32);
+    std::atomic<bool> startflag = {{false}};
+    auto thread_func = [&allocator, num_iter, &startflag]() {
+        constexpr int WINDOW = 256;
+        void *held[WINDOW] = {nullptr};
+        while (!startflag)
+            ;
+        for (int i = 0; i < num_iter; i++)
+        {
+            auto &slot = held[i % WINDOW];
+            if (slot)
+            {
+                allocator.dealloc(slot);
+            }
+            slot = allocator.alloc();
+        }
+        for (auto p : held)
+        {
+            if (p)
+                allocator.dealloc(p);
+        }
+    };
+    std::thread threads[numthreads];
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i] = std::thread(thread_func);
+    }
+    startflag = true;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numthreads; i++)
+    {
+        threads[i].join();
+    }
+    auto endt = std::chrono::high_resolution_clock::now();
+    if (printit)
+        printf("TIME= %ld ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(endt - start).count());
+}
+
+void alloc_test(int numthreads)
+{
+    printf("******************\nAlloc/free test\n");
+    int num_iter = 10000000;
+    printf("====================\nHeapAllocator\n");
+    do_alloc_test<HeapAllocator>(1000, false, numthreads);
+    do_alloc_test<HeapAllocator>(num_iter, true, numthreads);
+
+    printf("====================\nMemoryPool without thread cache\n");
+    do_alloc_test<UncachedMemoryPool>(1000, false, numthreads);
+    do_alloc_test<UncachedMemoryPool>(num_iter, true, numthreads);
+
+    printf("====================\nMemoryPool\n");
+    do_alloc_test<DefaultMemoryPool>(1000, false, numthreads);
+    do_alloc_test<DefaultMemoryPool>(num_iter, true, numthreads);
 }
 
 int main(int args, char *argv[])
@@ -220,4 +1413,21 @@ int main(int args, char *argv[])
     perf_test(80, numthreads);
     perf_test(100, numthreads);
     multi_thread_read_same_entry(numthreads);
+    insert_test(numthreads);
+    alloc_test(numthreads);
+    string_key_test(numthreads);
+    string_insert_test(numthreads);
+    hash_test(numthreads);
+    batch_get_test(numthreads);
+    false_sharing_test(numthreads);
+    lock_test(numthreads);
+    gc_test();
+    remove_test(numthreads);
+    churn_test(numthreads);
+    counter_test(numthreads);
+    word_count_test(numthreads);
+    parse_test(numthreads);
+    foreach_test(numthreads);
+    bulk_insert_test(numthreads);
+    snapshot_test(numthreads);
 }
\ No newline at end of file
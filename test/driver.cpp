@@ -0,0 +1,754 @@
+#include <Kuai/ConcurrentHashMap.hpp>
+#include <Kuai/FlatHashMap.hpp>
+#include <Kuai/Globals.hpp>
+#include <utility>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#ifdef BENCH_TBB
+#include "tbb/concurrent_hash_map.h"
+#endif
+using namespace Kuai;
+
+/**
+ * The configurable benchmark driver. The map is filled with all keys, and then each thread runs a mix of get/set/remove
+ * on the keys drawn from a uniform or Zipfian distribution. The operations are generated before the timing. The results
+ * are written in JSON, one entry per map and thread number, with the best ops/sec of the repeats
+ * */
+static const char *usage =
+    "Usage: driver [options]\n"
+    "  --maps=a,b,...       removable,noremove,hazard,striped,pool,lockfree,flat,flat-noremove,frozen,std,std-locked,tbb\n"
+    "                       or all (default). frozen and std only run read-only mixes, tbb needs BENCH_TBB\n"
+    "  --key=TYPE           int (default), uint64 or string\n"
+    "  --value-size=N       8 (default), 64, 256 or 1024 bytes\n"
+    "  --dist=D             uniform (default) or zipf\n"
+    "  --zipf-theta=T       the skew of the Zipfian distribution in (0, 1), default 0.99\n"
+    "  --keys=N             the number of keys, default 1048576\n"
+    "  --ops=N              the operations per thread, default 1000000\n"
+    "  --mix=R,W,D          the percentages of get, set and remove, default 80,20,0\n"
+    "  --threads=LIST       the thread numbers, like 1,2,4 or 1-8, default 1,2,4\n"
+    "  --repeat=N           run each case N times and report the best, default 1\n"
+    "  --output=FILE        write the JSON to FILE instead of stdout\n";
+
+struct Config
+{
+    std::vector<std::string> maps;
+    std::string keyType = "int";
+    size_t valueSize = 8;
+    std::string dist = "uniform";
+    double zipfTheta = 0.99;
+    size_t numKeys = 1024 * 1024;
+    size_t opsPerThread = 1000000;
+    int readPercent = 80;
+    int writePercent = 20;
+    int removePercent = 0;
+    std::vector<int> threads = {1, 2, 4};
+    int repeat = 1;
+    std::string output;
+};
+
+struct Result
+{
+    std::string map;
+    int threads;
+    uint64_t ops;
+    double seconds;
+};
+
+template <size_t N>
+struct Value
+{
+    char data[N];
+    Value() = default;
+    explicit Value(uint64_t x)
+    {
+        memset(data, 0, N);
+        memcpy(data, &x, N < sizeof(x) ? N : sizeof(x));
+    }
+};
+
+template <typename K>
+K makeKey(size_t i);
+
+template <>
+int makeKey<int>(size_t i)
+{
+    return int(i);
+}
+
+// spread the keys over all 64 bits
+template <>
+uint64_t makeKey<uint64_t>(size_t i)
+{
+    return uint64_t(i) * 0x9e3779b97f4a7c15ULL;
+}
+
+template <>
+std::string makeKey<std::string>(size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user%012zu", i);
+    return buf;
+}
+
+static uint64_t splitmix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double uniform01(uint64_t &state)
+{
+    return double(splitmix64(state) >> 11) / double(1ULL << 53);
+}
+
+// the Zipfian generator of YCSB (Gray et al., "Quickly generating billion-record synthetic databases")
+struct Zipfian
+{
+    size_t n;
+    double theta, alpha, zetan, eta;
+    Zipfian(size_t n, double theta) : n(n), theta(theta)
+    {
+        zetan = 0;
+        for (size_t i = 1; i <= n; i++)
+        {
+            zetan += 1 / pow(double(i), theta);
+        }
+        double zeta2 = 1 + pow(0.5, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    // the rank of the key, 0 is the hottest
+    size_t next(uint64_t &state) const
+    {
+        double u = uniform01(state);
+        double uz = u * zetan;
+        if (uz < 1)
+        {
+            return 0;
+        }
+        if (uz < 1 + pow(0.5, theta))
+        {
+            return 1;
+        }
+        size_t r = size_t(n * pow(eta * u - eta + 1, alpha));
+        return r < n ? r : n - 1;
+    }
+};
+
+// the operation is in the top 2 bits and the key index in the others
+enum Op : uint32_t
+{
+    OP_GET = 0,
+    OP_SET = 1,
+    OP_REMOVE = 2
+};
+static constexpr unsigned OP_SHIFT = 30;
+
+static std::vector<std::vector<uint32_t>> makeOps(const Config &cfg, int numThreads)
+{
+    std::vector<std::vector<uint32_t>> ops(numThreads);
+    Zipfian *zipf = cfg.dist == "zipf" ? new Zipfian(cfg.numKeys, cfg.zipfTheta) : nullptr;
+    for (int t = 0; t < numThreads; t++)
+    {
+        uint64_t state = 12345 + t;
+        ops[t].resize(cfg.opsPerThread);
+        for (auto &op : ops[t])
+        {
+            size_t idx;
+            if (zipf)
+            {
+                // scatter the hot keys over the key space. The multiplier is a prime, so it is a permutation unless
+                // numKeys is a multiple of it
+                idx = zipf->next(state) * 2654435761ULL % cfg.numKeys;
+            }
+            else
+            {
+                idx = splitmix64(state) % cfg.numKeys;
+            }
+            int dice = int(splitmix64(state) % 100);
+            uint32_t kind = dice < cfg.readPercent ? OP_GET : dice < cfg.readPercent + cfg.writePercent ? OP_SET : OP_REMOVE;
+            op = (kind << OP_SHIFT) | uint32_t(idx);
+        }
+    }
+    delete zipf;
+    return ops;
+}
+
+/**
+ * The adapters give the maps the same interface. read() adds the first byte of the value to (sink), so that the reads
+ * are not optimized out. remove() ignores the keys not found
+ * */
+template <typename K, typename V, typename Policy, typename Map = ConHashMap<Policy, K, V>>
+struct KuaiAdapter
+{
+    static constexpr bool canWrite = true;
+    static constexpr bool canRemove = Policy::canRemove;
+    Map map;
+    KuaiAdapter(size_t size) : map(size) {}
+    void finishLoading() {}
+    void set(const K &k, const V &v)
+    {
+        map.set(k, v);
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        const V *p = map.get(k);
+        sink += p ? p->data[0] : 0;
+    }
+    template <typename P = Policy>
+    typename std::enable_if<P::canRemove>::type remove(const K &k)
+    {
+        if (!map.get(k))
+        {
+            return;
+        }
+        try
+        {
+            map.remove(k);
+        }
+        catch (std::runtime_error &)
+        {
+            // removed by another thread
+        }
+    }
+    template <typename P = Policy>
+    typename std::enable_if<!P::canRemove>::type remove(const K &k)
+    {
+    }
+};
+
+// the removable maps free the removed nodes automatically
+template <typename K, typename V, typename Map = ConHashMap<PolicyCanRemove, K, V>>
+struct ReclaimingAdapter : KuaiAdapter<K, V, PolicyCanRemove, Map>
+{
+    ReclaimingAdapter(size_t size) : KuaiAdapter<K, V, PolicyCanRemove, Map>(size)
+    {
+        this->map.setReclaimThreshold(1024);
+    }
+};
+
+template <typename K, typename V>
+struct LockFreeInsertAdapter : ReclaimingAdapter<K, V>
+{
+    LockFreeInsertAdapter(size_t size) : ReclaimingAdapter<K, V>(size)
+    {
+        this->map.setLockFreeInsert(true);
+    }
+};
+
+template <typename K, typename V, typename Policy, typename Map = FlatHashMap<Policy, K, V>>
+struct FlatAdapter
+{
+    static constexpr bool canWrite = true;
+    static constexpr bool canRemove = Policy::canRemove;
+    Map map;
+    FlatAdapter(size_t size) : map(size) {}
+    void finishLoading() {}
+    void set(const K &k, const V &v)
+    {
+        map.set(k, v);
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        V v;
+        sink += map.get(k, v) ? v.data[0] : 0;
+    }
+    template <typename P = Policy>
+    typename std::enable_if<P::canRemove>::type remove(const K &k)
+    {
+        try
+        {
+            map.remove(k);
+        }
+        catch (std::runtime_error &)
+        {
+        }
+    }
+    template <typename P = Policy>
+    typename std::enable_if<!P::canRemove>::type remove(const K &k)
+    {
+    }
+};
+
+// filled through a ConHashMap, and frozen before the timing
+template <typename K, typename V>
+struct FrozenAdapter
+{
+    typedef ConHashMap<PolicyNoRemove, K, V> Builder;
+    static constexpr bool canWrite = false;
+    static constexpr bool canRemove = false;
+    Builder builder;
+    typename Builder::FrozenType frozen;
+    FrozenAdapter(size_t size) : builder(size) {}
+    void finishLoading()
+    {
+        frozen = builder.freeze();
+    }
+    void set(const K &k, const V &v)
+    {
+        builder.set(k, v);
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        const V *p = frozen.get(k);
+        sink += p ? p->data[0] : 0;
+    }
+    void remove(const K &k) {}
+};
+
+// std::unordered_map without a lock, only for read-only mixes
+template <typename K, typename V>
+struct StdAdapter
+{
+    static constexpr bool canWrite = false;
+    static constexpr bool canRemove = false;
+    std::unordered_map<K, V> impl;
+    StdAdapter(size_t size) : impl(size) {}
+    void finishLoading() {}
+    void set(const K &k, const V &v)
+    {
+        impl[k] = v;
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        auto itr = impl.find(k);
+        sink += itr != impl.end() ? itr->second.data[0] : 0;
+    }
+    void remove(const K &k) {}
+};
+
+template <typename K, typename V>
+struct StdLockedAdapter
+{
+    static constexpr bool canWrite = true;
+    static constexpr bool canRemove = true;
+    std::unordered_map<K, V> impl;
+    pthread_rwlock_t lk;
+    StdLockedAdapter(size_t size) : impl(size)
+    {
+        pthread_rwlock_init(&lk, nullptr);
+    }
+    ~StdLockedAdapter()
+    {
+        pthread_rwlock_destroy(&lk);
+    }
+    void finishLoading() {}
+    void set(const K &k, const V &v)
+    {
+        pthread_rwlock_wrlock(&lk);
+        impl[k] = v;
+        pthread_rwlock_unlock(&lk);
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        pthread_rwlock_rdlock(&lk);
+        auto itr = impl.find(k);
+        sink += itr != impl.end() ? itr->second.data[0] : 0;
+        pthread_rwlock_unlock(&lk);
+    }
+    void remove(const K &k)
+    {
+        pthread_rwlock_wrlock(&lk);
+        impl.erase(k);
+        pthread_rwlock_unlock(&lk);
+    }
+};
+
+#ifdef BENCH_TBB
+template <typename K, typename V>
+struct TbbAdapter
+{
+    typedef tbb::concurrent_hash_map<K, V> tbbmap;
+    static constexpr bool canWrite = true;
+    static constexpr bool canRemove = true;
+    tbbmap impl;
+    TbbAdapter(size_t size) : impl(size) {}
+    void finishLoading() {}
+    void set(const K &k, const V &v)
+    {
+        typename tbbmap::accessor acc;
+        impl.insert(acc, k);
+        acc->second = v;
+    }
+    void read(const K &k, uint64_t &sink)
+    {
+        typename tbbmap::const_accessor acc;
+        sink += impl.find(acc, k) ? acc->second.data[0] : 0;
+    }
+    void remove(const K &k)
+    {
+        impl.erase(k);
+    }
+};
+#endif
+
+static std::atomic<uint64_t> globalSink = {0};
+
+template <typename Adapter, typename K, typename V>
+Result runCase(const Config &cfg, const char *name, const std::vector<K> &keys, const std::vector<std::vector<uint32_t>> &ops,
+               int numThreads)
+{
+    Adapter map(cfg.numKeys);
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        map.set(keys[i], V(i));
+    }
+    map.finishLoading();
+    std::atomic<bool> startflag = {false};
+    auto threadFunc = [&](int tid) {
+        while (!startflag)
+            ;
+        uint64_t sink = 0;
+        for (uint32_t op : ops[tid])
+        {
+            const K &k = keys[op & ((1u << OP_SHIFT) - 1)];
+            switch (op >> OP_SHIFT)
+            {
+            case OP_GET:
+                map.read(k, sink);
+                break;
+            case OP_SET:
+                map.set(k, V(op));
+                break;
+            default:
+                map.remove(k);
+                break;
+            }
+        }
+        globalSink += sink;
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back(threadFunc, i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    startflag = true;
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    auto endt = std::chrono::steady_clock::now();
+    Result ret;
+    ret.map = name;
+    ret.threads = numThreads;
+    ret.ops = uint64_t(numThreads) * cfg.opsPerThread;
+    ret.seconds = std::chrono::duration<double>(endt - start).count();
+    return ret;
+}
+
+template <typename Adapter, typename K, typename V>
+void runMap(const Config &cfg, const char *name, const std::vector<K> &keys, std::vector<Result> &results)
+{
+    if ((!Adapter::canWrite && (cfg.writePercent || cfg.removePercent)) || (!Adapter::canRemove && cfg.removePercent))
+    {
+        fprintf(stderr, "%s: skipped, the mix is not supported\n", name);
+        return;
+    }
+    for (int numThreads : cfg.threads)
+    {
+        auto ops = makeOps(cfg, numThreads);
+        Result best;
+        for (int r = 0; r < cfg.repeat; r++)
+        {
+            Result res = runCase<Adapter, K, V>(cfg, name, keys, ops, numThreads);
+            if (r == 0 || res.seconds < best.seconds)
+            {
+                best = res;
+            }
+        }
+        fprintf(stderr, "%s, %d threads: %.0f ops/s\n", name, numThreads, best.ops / best.seconds);
+        results.push_back(best);
+    }
+}
+
+// FlatHashMap only supports the trivially copyable keys
+template <typename K, typename V, typename Policy>
+void runFlat(const Config &cfg, const char *name, const std::vector<K> &keys, std::vector<Result> &results, std::true_type)
+{
+    runMap<FlatAdapter<K, V, Policy>, K, V>(cfg, name, keys, results);
+}
+
+template <typename K, typename V, typename Policy>
+void runFlat(const Config &cfg, const char *name, const std::vector<K> &keys, std::vector<Result> &results, std::false_type)
+{
+    fprintf(stderr, "%s: skipped, the key type is not supported\n", name);
+}
+
+template <typename K, typename V>
+void runMaps(const Config &cfg, std::vector<Result> &results)
+{
+    std::vector<K> keys;
+    keys.reserve(cfg.numKeys);
+    for (size_t i = 0; i < cfg.numKeys; i++)
+    {
+        keys.push_back(makeKey<K>(i));
+    }
+    typedef std::integral_constant<bool, std::is_trivially_copyable<K>::value> flatKey;
+    for (auto &name : cfg.maps)
+    {
+        const char *n = name.c_str();
+        if (name == "removable")
+            runMap<ReclaimingAdapter<K, V>, K, V>(cfg, n, keys, results);
+        else if (name == "noremove")
+            runMap<KuaiAdapter<K, V, PolicyNoRemove>, K, V>(cfg, n, keys, results);
+        else if (name == "hazard")
+            runMap<KuaiAdapter<K, V, PolicyHazardPointer>, K, V>(cfg, n, keys, results);
+        else if (name == "striped")
+            runMap<ReclaimingAdapter<K, V, ConHashMap<PolicyCanRemove, K, V, std::hash<K>, std::equal_to<K>, HeapAllocator, MixMurmur, LayoutStripedLock>>, K, V>(
+                cfg, n, keys, results);
+        else if (name == "pool")
+            runMap<ReclaimingAdapter<K, V, ConHashMap<PolicyCanRemove, K, V, std::hash<K>, std::equal_to<K>, MemoryPool>>, K, V>(cfg, n, keys, results);
+        else if (name == "lockfree")
+            runMap<LockFreeInsertAdapter<K, V>, K, V>(cfg, n, keys, results);
+        else if (name == "flat")
+            runFlat<K, V, PolicyCanRemove>(cfg, n, keys, results, flatKey());
+        else if (name == "flat-noremove")
+            runFlat<K, V, PolicyNoRemove>(cfg, n, keys, results, flatKey());
+        else if (name == "frozen")
+            runMap<FrozenAdapter<K, V>, K, V>(cfg, n, keys, results);
+        else if (name == "std")
+            runMap<StdAdapter<K, V>, K, V>(cfg, n, keys, results);
+        else if (name == "std-locked")
+            runMap<StdLockedAdapter<K, V>, K, V>(cfg, n, keys, results);
+#ifdef BENCH_TBB
+        else if (name == "tbb")
+            runMap<TbbAdapter<K, V>, K, V>(cfg, n, keys, results);
+#endif
+        else
+            fprintf(stderr, "%s: skipped, unknown map\n", n);
+    }
+}
+
+template <typename K>
+bool runWithKey(const Config &cfg, std::vector<Result> &results)
+{
+    switch (cfg.valueSize)
+    {
+    case 8:
+        runMaps<K, Value<8>>(cfg, results);
+        return true;
+    case 64:
+        runMaps<K, Value<64>>(cfg, results);
+        return true;
+    case 256:
+        runMaps<K, Value<256>>(cfg, results);
+        return true;
+    case 1024:
+        runMaps<K, Value<1024>>(cfg, results);
+        return true;
+    }
+    return false;
+}
+
+static std::vector<std::string> splitList(const char *s)
+{
+    std::vector<std::string> ret;
+    std::string cur;
+    for (; *s; s++)
+    {
+        if (*s == ',')
+        {
+            ret.push_back(cur);
+            cur.clear();
+        }
+        else
+        {
+            cur += *s;
+        }
+    }
+    ret.push_back(cur);
+    return ret;
+}
+
+// parse a positive integer, which should be the whole string
+static bool parsePositive(const std::string &s, long &out)
+{
+    char *end;
+    errno = 0;
+    out = strtol(s.c_str(), &end, 10);
+    return !s.empty() && *end == 0 && errno == 0 && out > 0;
+}
+
+// parse a percentage in [0, 100], which should be the whole string
+static bool parsePercent(const std::string &s, int &out)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(s.c_str(), &end, 10);
+    out = int(v);
+    return !s.empty() && *end == 0 && errno == 0 && v >= 0 && v <= 100;
+}
+
+// parse the skew of the Zipfian distribution, which should be in (0, 1)
+static bool parseTheta(const char *s, double &out)
+{
+    char *end;
+    errno = 0;
+    out = strtod(s, &end);
+    return *s && *end == 0 && errno == 0 && out > 0 && out < 1;
+}
+
+// "1,2,4" or "1-8". Returns false if a thread number is not positive or cannot be parsed
+static bool parseThreads(const char *s, std::vector<int> &out)
+{
+    static const long MAX_THREADS = 4096;
+    out.clear();
+    for (auto &item : splitList(s))
+    {
+        auto dash = item.find('-');
+        long lo, hi;
+        if (dash == std::string::npos)
+        {
+            if (!parsePositive(item, lo))
+            {
+                return false;
+            }
+            hi = lo;
+        }
+        else if (!parsePositive(item.substr(0, dash), lo) || !parsePositive(item.substr(dash + 1), hi) || lo > hi)
+        {
+            return false;
+        }
+        if (hi > MAX_THREADS)
+        {
+            return false;
+        }
+        for (long i = lo; i <= hi; i++)
+        {
+            out.push_back(int(i));
+        }
+    }
+    return true;
+}
+
+static bool parseArgs(int argc, char *argv[], Config &cfg)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *eq = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) || !eq)
+        {
+            return false;
+        }
+        std::string name(arg + 2, eq);
+        const char *v = eq + 1;
+        long n = 0;
+        bool isCount = name == "value-size" || name == "keys" || name == "ops" || name == "repeat";
+        if (isCount && !parsePositive(v, n))
+            return false;
+        if (name == "maps")
+            cfg.maps = splitList(v);
+        else if (name == "key")
+            cfg.keyType = v;
+        else if (name == "value-size")
+            cfg.valueSize = n;
+        else if (name == "dist")
+            cfg.dist = v;
+        else if (name == "zipf-theta")
+        {
+            if (!parseTheta(v, cfg.zipfTheta))
+                return false;
+        }
+        else if (name == "keys")
+            cfg.numKeys = n;
+        else if (name == "ops")
+            cfg.opsPerThread = n;
+        else if (name == "mix")
+        {
+            auto parts = splitList(v);
+            if (parts.size() != 3 || !parsePercent(parts[0], cfg.readPercent) || !parsePercent(parts[1], cfg.writePercent) ||
+                !parsePercent(parts[2], cfg.removePercent))
+                return false;
+        }
+        else if (name == "threads")
+        {
+            if (!parseThreads(v, cfg.threads))
+                return false;
+        }
+        else if (name == "repeat")
+            cfg.repeat = int(n);
+        else if (name == "output")
+            cfg.output = v;
+        else
+            return false;
+    }
+    if (cfg.maps.empty() || (cfg.maps.size() == 1 && cfg.maps[0] == "all"))
+    {
+        cfg.maps = {"removable", "noremove", "hazard", "striped", "pool", "lockfree", "flat", "flat-noremove", "frozen", "std", "std-locked"};
+#ifdef BENCH_TBB
+        cfg.maps.push_back("tbb");
+#endif
+    }
+    bool zipfOk = cfg.dist == "uniform" || cfg.dist == "zipf";
+    return zipfOk && cfg.readPercent + cfg.writePercent + cfg.removePercent == 100 && cfg.numKeys > 0 &&
+           cfg.numKeys < (size_t(1) << OP_SHIFT) && cfg.repeat > 0 && !cfg.threads.empty();
+}
+
+static void writeJson(FILE *f, const Config &cfg, const std::vector<Result> &results)
+{
+    fprintf(f, "{\n  \"config\": {\"key\": \"%s\", \"value_size\": %zu, \"distribution\": \"%s\", \"zipf_theta\": %g, "
+               "\"keys\": %zu, \"ops_per_thread\": %zu, \"read\": %d, \"write\": %d, \"remove\": %d, \"repeat\": %d},\n",
+            cfg.keyType.c_str(), cfg.valueSize, cfg.dist.c_str(), cfg.zipfTheta, cfg.numKeys, cfg.opsPerThread, cfg.readPercent,
+            cfg.writePercent, cfg.removePercent, cfg.repeat);
+    fprintf(f, "  \"results\": [");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto &r = results[i];
+        fprintf(f, "%s\n    {\"map\": \"%s\", \"threads\": %d, \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.0f}", i ? "," : "",
+                r.map.c_str(), r.threads, (unsigned long long)r.ops, r.seconds, r.ops / r.seconds);
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Config cfg;
+    if (!parseArgs(argc, argv, cfg))
+    {
+        fputs(usage, stderr);
+        return 1;
+    }
+    std::vector<Result> results;
+    bool ok;
+    if (cfg.keyType == "int")
+        ok = runWithKey<int>(cfg, results);
+    else if (cfg.keyType == "uint64")
+        ok = runWithKey<uint64_t>(cfg, results);
+    else if (cfg.keyType == "string")
+        ok = runWithKey<std::string>(cfg, results);
+    else
+        ok = false;
+    if (!ok)
+    {
+        fputs(usage, stderr);
+        return 1;
+    }
+    FILE *f = cfg.output.empty() ? stdout : fopen(cfg.output.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot open %s\n", cfg.output.c_str());
+        return 1;
+    }
+    writeJson(f, cfg, results);
+    if (f != stdout)
+    {
+        fclose(f);
+    }
+    return 0;
+}
@@ -1,9 +1,14 @@
 #include <Kuai/ConcurrentHashMap.hpp>
+#include <Kuai/FlatHashMap.hpp>
 #include <Kuai/Globals.hpp>
 #include <utility>
 #include <cassert>
 #include <thread>
 #include <string.h>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+#include <stdexcept>
 using namespace Kuai;
 
 constexpr int bufsize = 1024 * 1024 * 64;
@@ -175,9 +180,1197 @@ void removalTest()
     gcThread.join();
 }
 
+// the nodes removed before an idle thread updates its clock are freed together after it does
+void gcTest()
+{
+    static std::atomic<int> freed = {0};
+    struct Counted
+    {
+        bool counted = false;
+        ~Counted()
+        {
+            if (counted)
+            {
+                ++freed;
+            }
+        }
+    };
+    ConHashMap<PolicyCanRemove, int, Counted> map(1024);
+    for (int i = 0; i < 2000; i++)
+    {
+        map.set(i, Counted());
+        map.get(i)->counted = true;
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    int requested = 0, acked = 0;
+    // a thread which only updates its local clock when requested
+    std::thread idle([&]() {
+        PolicyCanRemove::updateLocalClock();
+        std::unique_lock<std::mutex> guard(mtx);
+        for (;;)
+        {
+            acked++;
+            cv.notify_all();
+            cv.wait(guard, [&]() { return requested != acked - 1; });
+            if (requested < 0)
+            {
+                return;
+            }
+            PolicyCanRemove::updateLocalClock();
+        }
+    });
+    auto syncIdle = [&]() {
+        std::unique_lock<std::mutex> guard(mtx);
+        requested++;
+        cv.notify_all();
+        cv.wait(guard, [&]() { return acked == requested + 1; });
+    };
+    syncIdle();
+    for (int i = 0; i < 1000; i++)
+    {
+        map.remove(i);
+    }
+    map.garbageCollect();
+    myassert(freed == 0);
+    syncIdle();
+    for (int i = 1000; i < 2000; i++)
+    {
+        map.remove(i);
+    }
+    map.garbageCollect();
+    myassert(freed == 1000);
+    syncIdle();
+    map.garbageCollect();
+    myassert(freed == 2000);
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        requested = -1;
+        cv.notify_all();
+    }
+    idle.join();
+}
+
+// the removed nodes are freed without explicit GC passes
+void reclaimTest()
+{
+    {
+        ConHashMap<PolicyCanRemove, int, int> map(1024);
+        map.setReclaimThreshold(64);
+        for (int i = 0; i < 10000; i++)
+        {
+            map.set(i, i);
+            map.remove(i);
+        }
+        myassert(map.pendingRemoved() < 64);
+    }
+    {
+        ConHashMap<PolicyCanRemove, int, int> map(1024);
+        // the cap takes effect before the threshold
+        map.setReclaimThreshold(1000000, 4096);
+        for (int i = 0; i < 10000; i++)
+        {
+            map.set(i, i);
+            map.remove(i);
+            myassert(map.pendingRemoved() <= 4096 / 16);
+        }
+    }
+    {
+        ConHashMap<PolicyCanRemove, int, int> map(1024);
+        map.startReclaimer(std::chrono::milliseconds(1));
+        for (int i = 0; i < 10000; i++)
+        {
+            map.set(i, i);
+            map.remove(i);
+        }
+        for (int i = 0; i < 1000 && map.pendingRemoved(); i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        myassert(map.pendingRemoved() == 0);
+        // the map is destroyed with the reclaimer running
+    }
+}
+
+// the nodes read in a read section are not freed until the section is left
+void readGuardTest()
+{
+    using MapType = ConHashMap<PolicyCanRemove, int, int>;
+    MapType map(1024);
+    for (int i = 0; i < 100; i++)
+    {
+        map.set(i, i);
+    }
+    {
+        MapType::ReadGuard guard(map);
+        int *v = guard.get(1);
+        myassert(v && *v == 1);
+        myassert(!guard.get(1000));
+        {
+            MapType::ReadGuard inner(map);
+            myassert(*inner.get(2) == 2);
+        }
+        // the calls on the map and the removals in the section do not publish the clock
+        map.get(3);
+        map.remove(4);
+        std::thread([&]() {
+            map.remove(1);
+            map.garbageCollect();
+            myassert(map.pendingRemoved() == 2);
+        }).join();
+        myassert(*v == 1);
+    }
+    map.garbageCollect();
+    myassert(map.pendingRemoved() == 0);
+}
+
+// an idle thread only keeps the node it has read from being freed
+void hazardPointerTest()
+{
+    ConHashMap<PolicyHazardPointer, int, int> map(1024);
+    for (int i = 0; i < 10000; i++)
+    {
+        map.set(i, i);
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    int step = 0;
+    std::thread idle([&]() {
+        int *v = map.get(42);
+        std::unique_lock<std::mutex> guard(mtx);
+        step = 1;
+        cv.notify_all();
+        cv.wait(guard, [&]() { return step == 2; });
+        // the node is removed but not freed
+        myassert(*v == 42);
+        myassert(!map.get(42));
+        step = 3;
+        cv.notify_all();
+        cv.wait(guard, [&]() { return step == 4; });
+    });
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        cv.wait(guard, [&]() { return step == 1; });
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        map.remove(i);
+        myassert(map.pendingRemoved() <= PolicyHazardPointer::DeletionQueue::DEFAULT_SCAN_THRESHOLD);
+    }
+    map.garbageCollect();
+    // the idle thread also holds the node before the one it has read
+    myassert(map.pendingRemoved() >= 1 && map.pendingRemoved() <= HazardRecord::NUM_HAZARDS);
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        step = 2;
+        cv.notify_all();
+        cv.wait(guard, [&]() { return step == 3; });
+    }
+    map.garbageCollect();
+    myassert(map.pendingRemoved() == 0);
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        step = 4;
+        cv.notify_all();
+    }
+    idle.join();
+}
+
+// inserts and removes keys in multiple threads while the map is growing
+template <typename MapType>
+void growTest(MapType &map)
+{
+    constexpr int numKeys = 100000;
+    constexpr int numThreads = 4;
+    std::atomic<bool> done = {{false}};
+    std::thread reader([&]() {
+        while (!done)
+        {
+            for (int i = 0; i < numKeys; i += 97)
+            {
+                auto ret = map.get(i);
+                myassert(!ret || *ret == i);
+            }
+        }
+    });
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&map, t]() {
+            for (int i = t; i < numKeys; i += numThreads)
+            {
+                myassert(!map.setIfAbsent(i, i));
+                if (i % 3 == 0)
+                {
+                    map.remove(i);
+                }
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    done = true;
+    reader.join();
+    for (int i = 0; i < numKeys; i++)
+    {
+        auto ret = map.get(i);
+        if (i % 3 == 0)
+        {
+            myassert(!ret);
+        }
+        else
+        {
+            myassert(ret && *ret == i);
+        }
+    }
+    myassert(map.size() == numKeys - (numKeys + 2) / 3);
+    // the load factor is checked once every several insertions
+    myassert(map.bucketCount() * 2 >= map.size());
+    map.garbageCollect();
+}
+
+// the threads insert the same keys without locking, while the map is growing
+template <typename MapType>
+void lockFreeInsertTest(MapType &map)
+{
+    constexpr int numKeys = 50000;
+    constexpr int numThreads = 4;
+    map.setLockFreeInsert(true);
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&map, t]() {
+            for (int i = 0; i < numKeys; i++)
+            {
+                if (t % 2)
+                {
+                    map.set(i, i);
+                }
+                else
+                {
+                    auto old = map.setIfAbsent(i, i);
+                    myassert(!old || *old == i);
+                }
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    // no key is inserted twice
+    myassert(map.size() == numKeys);
+    for (int i = 0; i < numKeys; i++)
+    {
+        myassert(*map.get(i) == i);
+    }
+    MapType map2(2);
+    map2.setLockFreeInsert(true);
+    growTest(map2);
+}
+
+void resizeTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(2);
+    growTest(map);
+    // few lock stripes shared by many buckets
+    ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixMurmur, LayoutStripedLock> stripedMap(2, 4);
+    growTest(stripedMap);
+    ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixMurmur, LayoutInlineLock, TTASSpinLock> ttasMap(2);
+    growTest(ttasMap);
+    ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, HeapAllocator, MixMurmur, LayoutStripedLock, FutexLock> futexMap(2, 4);
+    growTest(futexMap);
+
+    ConHashMap<PolicyNoRemove, int, int> map2(16);
+    map2.reserve(5000);
+    auto reserved = map2.bucketCount();
+    myassert(reserved >= 5000);
+    for (int i = 0; i < 5000; i++)
+    {
+        map2.set(i, i);
+    }
+    myassert(map2.bucketCount() == reserved);
+    for (int i = 0; i < 5000; i++)
+    {
+        myassert(*map2.get(i) == i);
+    }
+
+    ConHashMap<PolicyCanRemove, int, int> lockFreeMap(2);
+    lockFreeInsertTest(lockFreeMap);
+    ConHashMap<PolicyHazardPointer, int, int> hazardMap(2);
+    lockFreeInsertTest(hazardMap);
+    printf("Resize test done, buckets=%zu\n", map.bucketCount());
+}
+
+void hashTest()
+{
+    static_assert(std::is_same<DefaultMixer<std::hash<int>>::type, MixMurmur>::value, "std::hash should be mixed");
+    static_assert(std::is_same<DefaultMixer<FastHash<int>>::type, MixNone>::value, "FastHash should not be mixed");
+    FastHash<std::string> strHash;
+    for (size_t len = 0; len < 20; len++)
+    {
+        std::string a(len, 'a');
+        std::string b = a;
+        myassert(strHash(a) == strHash(b));
+        if (len)
+        {
+            b[len - 1] = 'b';
+            myassert(strHash(a) != strHash(b));
+        }
+    }
+
+    // the keys which are multiples of a power of 2 go to the same bucket without mixing
+    ConHashMap<PolicyNoRemove, int, int, FastHash<int>> map(16);
+    for (int i = 0; i < 10000; i++)
+    {
+        map.set(i * 4096, i);
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        myassert(*map.get(i * 4096) == i);
+        myassert(!map.get(i * 4096 + 1));
+    }
+    ConHashMap<PolicyCanRemove, std::string, int, FastHash<std::string>> strMap(16);
+    for (int i = 0; i < 10000; i++)
+    {
+        strMap.set(std::to_string(i), i);
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        strMap.remove(std::to_string(i));
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        auto ret = strMap.get(std::to_string(i));
+        myassert((i % 2) ? (ret && *ret == i) : !ret);
+    }
+    strMap.garbageCollect();
+}
+
+// the threads count the keys with compute and merge, and create the values with computeIfAbsent
+template <typename MapType>
+void aggregateTest(MapType &map)
+{
+    constexpr int numKeys = 1000;
+    constexpr int numIter = 100000;
+    constexpr int numThreads = 4;
+    std::atomic<int> created = {0};
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&map, &created, t]() {
+            for (int i = 0; i < numIter; i++)
+            {
+                int k = i % numKeys;
+                if (t % 2)
+                {
+                    map.compute(k, [](int &v, bool found) {
+                        myassert(found || v == 0);
+                        v++;
+                    });
+                }
+                else
+                {
+                    map.merge(k, 1, [](int &v, const int &delta) { v += delta; });
+                }
+                map.computeIfAbsent(k + numKeys, [&created, k]() {
+                    ++created;
+                    return k;
+                });
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    // the factory is only called when the key is inserted
+    myassert(created == numKeys);
+    myassert(map.size() == numKeys * 2);
+    for (int i = 0; i < numKeys; i++)
+    {
+        myassert(*map.get(i) == numIter / numKeys * numThreads);
+        myassert(*map.computeIfAbsent(i + numKeys, []() { return -1; }) == i);
+    }
+    myassert(!map.merge(0, 10, [](int &v, const int &delta) { v -= delta; }));
+    myassert(*map.get(0) == numIter / numKeys * numThreads - 10);
+}
+
+// counts the live objects
+struct Counted
+{
+    static int live;
+    int v = 0;
+    Counted()
+    {
+        live++;
+    }
+    Counted(const Counted &other) : v(other.v)
+    {
+        live++;
+    }
+    Counted &operator=(const Counted &other) = default;
+    ~Counted()
+    {
+        live--;
+    }
+};
+int Counted::live = 0;
+
+void computeTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(64);
+    aggregateTest(map);
+    // the lock-free inserters race with the locked ones
+    ConHashMap<PolicyHazardPointer, int, int> hazardMap(64);
+    hazardMap.setLockFreeInsert(true);
+    aggregateTest(hazardMap);
+
+    // if fn throws on a new key, the key is not inserted and its node is freed
+    {
+        ConHashMap<PolicyCanRemove, int, Counted> countedMap(64);
+        countedMap.compute(1, [](Counted &v, bool found) { v.v = 1; });
+        bool thrown = false;
+        try
+        {
+            countedMap.compute(2, [](Counted &v, bool found) { throw std::runtime_error("fn"); });
+        }
+        catch (std::runtime_error &)
+        {
+            thrown = true;
+        }
+        myassert(thrown);
+        myassert(!countedMap.get(2));
+        myassert(countedMap.size() == 1);
+        myassert(Counted::live == 1);
+        // the bucket lock is released
+        myassert(countedMap.compute(2, [](Counted &v, bool found) { v.v = 2; }));
+        myassert(countedMap.get(2)->v == 2);
+    }
+    myassert(Counted::live == 0);
+}
+
+// the threads add to the same keys. The new keys are inserted by the first adder
+void incrementTest()
+{
+    constexpr int numKeys = 100;
+    constexpr int numIter = 100000;
+    constexpr int numThreads = 4;
+    ConHashMap<PolicyCanRemove, int, uint64_t> map(16);
+    std::atomic<int> inserted = {0};
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&map, &inserted, t]() {
+            for (int i = 0; i < numIter; i++)
+            {
+                if (map.fetchAdd(i % numKeys, 2) == 0)
+                {
+                    ++inserted;
+                }
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    myassert(inserted == numKeys);
+    myassert(map.size() == numKeys);
+    for (int i = 0; i < numKeys; i++)
+    {
+        myassert(*map.get(i) == uint64_t(numIter / numKeys * numThreads * 2));
+    }
+    myassert(map.increment(0) == uint64_t(numIter / numKeys * numThreads * 2 + 1));
+    myassert(map.increment(numKeys, 5) == 5);
+}
+
+// counts the copies of the objects. Not default-constructible
+struct Tracked
+{
+    static int copies;
+    int a, b;
+    Tracked(int a, int b) : a(a), b(b) {}
+    Tracked(const Tracked &other) : a(other.a), b(other.b)
+    {
+        copies++;
+    }
+    Tracked(Tracked &&other) : a(other.a), b(other.b)
+    {
+        other.a = -1;
+    }
+    Tracked &operator=(const Tracked &other)
+    {
+        a = other.a;
+        b = other.b;
+        copies++;
+        return *this;
+    }
+    Tracked &operator=(Tracked &&other)
+    {
+        a = other.a;
+        b = other.b;
+        other.a = -1;
+        return *this;
+    }
+    bool operator==(const Tracked &other) const
+    {
+        return a == other.a && b == other.b;
+    }
+};
+int Tracked::copies = 0;
+
+struct TrackedHash
+{
+    size_t operator()(const Tracked &t) const
+    {
+        return t.a * 31 + t.b;
+    }
+};
+
+void emplaceTest()
+{
+    ConHashMap<PolicyCanRemove, Tracked, Tracked, TrackedHash> map(16);
+    map.emplace(Tracked(1, 2), 3, 4);
+    myassert(*map.get(Tracked(1, 2)) == Tracked(3, 4));
+    // the existing value is replaced
+    map.emplace(Tracked(1, 2), 5, 6);
+    myassert(*map.get(Tracked(1, 2)) == Tracked(5, 6));
+    myassert(map.tryEmplace(Tracked(1, 2), 7, 8)->a == 5);
+    myassert(!map.tryEmplace(Tracked(2, 2), 7, 8));
+    myassert(*map.get(Tracked(2, 2)) == Tracked(7, 8));
+    // the rvalue keys and values are moved into the nodes
+    Tracked key(3, 3), value(9, 9);
+    map.set(std::move(key), std::move(value));
+    myassert(key.a == -1 && value.a == -1);
+    myassert(*map.get(Tracked(3, 3)) == Tracked(9, 9));
+    Tracked key2(4, 4);
+    myassert(!map.setIfAbsent(std::move(key2), Tracked(1, 1)));
+    myassert(key2.a == -1);
+    myassert(Tracked::copies == 0);
+    // the lvalue keys are copied
+    Tracked key3(5, 5);
+    map.emplace(key3, 1, 1);
+    myassert(Tracked::copies == 1 && key3.a == 5);
+    myassert(map.size() == 5);
+
+    ConHashMap<PolicyCanRemove, std::string, std::vector<int>> vecMap(16);
+    // the vector of 3 elements
+    vecMap.emplace("a", 3, 7);
+    myassert(vecMap.get("a")->size() == 3);
+    vecMap.emplace("a", std::vector<int>{1});
+    myassert(vecMap.get("a")->size() == 1);
+    vecMap.emplace("b");
+    myassert(vecMap.get("b")->empty());
+}
+
+void sliceTest()
+{
+    static_assert(!IsTransparent<std::hash<std::string>>::value, "std::hash is not transparent");
+    static_assert(IsTransparent<FastHash<std::string>>::value, "FastHash<std::string> is transparent");
+    ConHashMap<PolicyCanRemove, std::string, int, FastHash<std::string>, StringEqual> map(16);
+    const char *text = "apple banana cherry";
+    StringSlice apple(text, 5), banana(text + 6, 6), cherry(text + 13, 6);
+    myassert(FastHash<std::string>()(apple) == FastHash<std::string>()(std::string("apple")));
+    map.set("apple", 1);
+    myassert(*map.get(apple) == 1);
+    myassert(!map.get(banana));
+    // the key is materialized when the slice is inserted
+    myassert(!map.setIfAbsent(banana, 2));
+    myassert(*map.setIfAbsent(banana, 3) == 2);
+    myassert(*map.get(std::string("banana")) == 2);
+    myassert(*map.get("banana") == 2);
+    map.remove(apple);
+    myassert(!map.get("apple"));
+    map.setLockFreeInsert(true);
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string key = "key" + std::to_string(i);
+        myassert(!map.setIfAbsent(StringSlice(key), i));
+    }
+    myassert(!map.setIfAbsent(cherry, 4));
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string key = "key" + std::to_string(i);
+        myassert(*map.get(StringSlice(key.data(), key.size())) == i);
+    }
+    myassert(*map.get(cherry) == 4);
+    myassert(map.size() == 1002);
+}
+
+// the keys present for the whole iteration are visited exactly once, while other threads insert and remove keys
+void iterateTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(16);
+    const int stable = 20000;
+    for (int i = 0; i < stable; i++)
+    {
+        map.set(i, i);
+    }
+    std::vector<int> visits(stable);
+    std::atomic<bool> done = {false};
+    std::thread writer([&]() {
+        for (int round = 0; !done; round++)
+        {
+            for (int i = stable; i < stable * 2; i++)
+            {
+                map.set(i, i);
+            }
+            for (int i = stable; i < stable * 2; i++)
+            {
+                map.remove(i);
+            }
+        }
+    });
+    for (int round = 0; round < 3; round++)
+    {
+        std::fill(visits.begin(), visits.end(), 0);
+        for (ConHashMap<PolicyCanRemove, int, int>::Iterator itr(map); itr.valid(); itr.next())
+        {
+            myassert(itr.key() == itr.value());
+            if (itr.key() < stable)
+            {
+                visits[itr.key()]++;
+            }
+        }
+        for (auto v : visits)
+        {
+            myassert(v == 1);
+        }
+    }
+    done = true;
+    writer.join();
+
+    std::vector<std::atomic<int>> parVisits(stable);
+    std::atomic<uint64_t> sum = {0};
+    map.parallelForEach(
+        [&](const int &k, int &v) {
+            if (k < stable)
+            {
+                parVisits[k]++;
+                sum += v;
+            }
+        },
+        4);
+    for (auto &v : parVisits)
+    {
+        myassert(v == 1);
+    }
+    myassert(sum == uint64_t(stable) * (stable - 1) / 2);
+    int count = 0;
+    map.forEach([&](const int &k, int &v) { count++; });
+    myassert(count == stable);
+
+    // the callbacks can write to the map and iterate it again. The growth waits until the iteration finishes
+    size_t buckets = map.bucketCount();
+    bool frozen = false;
+    map.forEach([&](const int &k, int &v) {
+        if (k < stable)
+        {
+            map.set(k + stable, k + stable);
+        }
+        if (!frozen)
+        {
+            frozen = true;
+            myassert(map.freeze().size() >= size_t(stable));
+            map.reserve(stable * 4);
+        }
+        myassert(map.bucketCount() == buckets);
+    });
+    myassert(map.size() == size_t(stable) * 2);
+    map.reserve(stable * 4);
+    myassert(map.bucketCount() >= size_t(stable) * 4);
+}
+
+void bulkInsertTest()
+{
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 100000; i++)
+    {
+        items.emplace_back(i % 50000, i);
+    }
+    // the later pair of the same key wins
+    ConHashMap<PolicyCanRemove, int, int> map(items.begin(), items.end(), 16, 4);
+    myassert(map.size() == 50000);
+    for (int i = 0; i < 50000; i++)
+    {
+        myassert(*map.get(i) == i + 50000);
+    }
+    // the existing keys are updated
+    std::vector<std::pair<int, int>> more;
+    for (int i = 45000; i < 55000; i++)
+    {
+        more.emplace_back(i, -i);
+    }
+    map.bulkInsert(more.begin(), more.end(), 3);
+    myassert(map.size() == 55000);
+    myassert(*map.get(44999) == 94999 && *map.get(45000) == -45000 && *map.get(54999) == -54999);
+
+    // the keys inserted by other threads during the bulk insert are not duplicated
+    ConHashMap<PolicyCanRemove, int, int> lfMap(1024);
+    lfMap.setLockFreeInsert(true);
+    std::vector<std::pair<int, int>> keys;
+    for (int i = 0; i < 200000; i++)
+    {
+        keys.emplace_back(i, 1);
+    }
+    std::thread inserter([&]() {
+        for (int i = 199999; i >= 0; i--)
+        {
+            lfMap.setIfAbsent(i, 2);
+        }
+    });
+    lfMap.bulkInsert(keys.begin(), keys.end(), 2);
+    inserter.join();
+    myassert(lfMap.size() == 200000);
+    std::vector<int> seen(200000);
+    lfMap.forEach([&](const int &k, int &v) {
+        myassert(v == 1 || v == 2);
+        seen[k]++;
+    });
+    for (auto v : seen)
+    {
+        myassert(v == 1);
+    }
+}
+
+void snapshotTest()
+{
+    std::string path = "/tmp/kuai_snapshot_" + std::to_string(getpid());
+    ConHashMap<PolicyCanRemove, int, int> map(1024);
+    const int stable = 100000;
+    for (int i = 0; i < stable; i++)
+    {
+        map.set(i, i * 2);
+    }
+    // the keys present for the whole save are in the snapshot
+    std::atomic<bool> done = {false};
+    std::thread writer([&]() {
+        while (!done)
+        {
+            for (int i = stable; i < stable + 1000; i++)
+            {
+                map.set(i, i * 2);
+            }
+            for (int i = stable; i < stable + 1000; i++)
+            {
+                map.remove(i);
+            }
+        }
+    });
+    map.saveSnapshot(path.c_str());
+    done = true;
+    writer.join();
+    ConHashMap<PolicyCanRemove, int, int> loaded(16);
+    loaded.loadSnapshot(path.c_str(), 2);
+    myassert(loaded.size() >= size_t(stable) && loaded.size() <= size_t(stable) + 1000);
+    for (int i = 0; i < stable; i++)
+    {
+        myassert(*loaded.get(i) == i * 2);
+    }
+
+    // an unfinished save keeps the previous snapshot
+    {
+        SnapshotWriter partial(path.c_str());
+        partial.buffer.append("partial");
+        partial.flush();
+    }
+    myassert(access((path + ".tmp").c_str(), F_OK) != 0);
+    ConHashMap<PolicyCanRemove, int, int> reloaded(16);
+    reloaded.loadSnapshot(path.c_str());
+    myassert(reloaded.size() == loaded.size());
+
+    // a snapshot of another type of map is rejected
+    ConHashMap<PolicyNoRemove, std::string, std::string> wrongType(16);
+    bool thrown = false;
+    try
+    {
+        wrongType.loadSnapshot(path.c_str());
+    }
+    catch (std::runtime_error &)
+    {
+        thrown = true;
+    }
+    myassert(thrown);
+
+    ConHashMap<PolicyNoRemove, std::string, std::string> strMap(16);
+    for (int i = 0; i < 1000; i++)
+    {
+        strMap.set(std::to_string(i), std::string(i % 50, 'a'));
+    }
+    strMap.saveSnapshot(path.c_str());
+    wrongType.loadSnapshot(path.c_str());
+    myassert(wrongType.size() == 1000);
+    for (int i = 0; i < 1000; i++)
+    {
+        myassert(*wrongType.get(std::to_string(i)) == std::string(i % 50, 'a'));
+    }
+
+    // a truncated snapshot is rejected
+    if (truncate(path.c_str(), 1000))
+    {
+        abort();
+    }
+    thrown = false;
+    try
+    {
+        strMap.loadSnapshot(path.c_str());
+    }
+    catch (std::runtime_error &)
+    {
+        thrown = true;
+    }
+    myassert(thrown);
+    remove(path.c_str());
+}
+
+void freezeTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(16);
+    for (int i = 0; i < 10000; i++)
+    {
+        map.set(i, i + 1);
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        map.remove(i);
+    }
+    auto frozen = map.freeze();
+    myassert(frozen.size() == 5000);
+    for (int i = 0; i < 10000; i++)
+    {
+        const int *v = frozen.get(i);
+        myassert(bool(v) == bool(i % 2));
+        myassert(!v || *v == i + 1);
+    }
+    myassert(!frozen.get(-1));
+    // the frozen map is a copy
+    map.set(1, 100);
+    myassert(*frozen.get(1) == 2);
+    int count = 0;
+    frozen.forEach([&](const int &k, const int &v) { count++; });
+    myassert(count == 5000);
+
+    ConHashMap<PolicyNoRemove, std::string, int, FastHash<std::string>> strMap(16);
+    auto empty = strMap.freeze();
+    myassert(empty.size() == 0 && !empty.get("a"));
+    strMap.set("a", 1);
+    strMap.set("b", 2);
+    auto strFrozen = strMap.freeze();
+    myassert(*strFrozen.get("a") == 1 && *strFrozen.get("b") == 2 && !strFrozen.get("c"));
+}
+
+void statsTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(1024);
+    for (int i = 0; i < 1000; i++)
+    {
+        map.set(i, i);
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        map.remove(i);
+    }
+    map.garbageCollect();
+    auto st = map.stats(8);
+    myassert(st.size == 900 && st.buckets == 1024);
+    myassert(st.loadFactor > 0.87f && st.loadFactor < 0.88f);
+    myassert(st.chainLengths.size() == 9);
+    size_t buckets = 0, nodes = 0;
+    for (size_t i = 0; i < st.chainLengths.size(); i++)
+    {
+        buckets += st.chainLengths[i];
+        nodes += i * st.chainLengths[i];
+    }
+    myassert(buckets == 1024 && nodes <= 900);
+    myassert(st.pendingRemoved <= 100);
+    if (StatCounters::enabled)
+    {
+        myassert(st.counters.nodesRetired == 100);
+        myassert(st.counters.gcPasses >= 1);
+        myassert(st.counters.nodesReclaimed == 100 - st.pendingRemoved);
+    }
+    else
+    {
+        myassert(st.counters.nodesRetired == 0 && st.counters.lockSpins == 0);
+    }
+    // the counters only count the events of their own map
+    ConHashMap<PolicyCanRemove, int, int> other(16);
+    for (int i = 0; i < 100; i++)
+    {
+        other.set(i, i);
+        other.remove(i);
+    }
+    other.garbageCollect();
+    auto st2 = map.stats(8);
+    myassert(st2.counters.nodesRetired == st.counters.nodesRetired && st2.counters.gcPasses == st.counters.gcPasses);
+    myassert(other.stats().counters.nodesRetired == (StatCounters::enabled ? 100 : 0));
+    ConHashMap<PolicyNoRemove, int, int> noRemove(16);
+    myassert(noRemove.stats().pendingRemoved == 0 && noRemove.stats().chainLengths[0] == 16);
+    myassert(noRemove.stats().counters.nodesRetired == 0);
+}
+
+void batchTest()
+{
+    ConHashMap<PolicyCanRemove, int, int> map(16);
+    std::vector<int> keys, values;
+    for (int i = 0; i < 1000; i++)
+    {
+        keys.push_back(i * 3);
+        values.push_back(i);
+    }
+    map.setBatch(keys.data(), values.data(), keys.size());
+    for (int i = 0; i < 1000; i++)
+    {
+        myassert(*map.get(i * 3) == i);
+        keys[i] = i;
+    }
+    std::vector<int *> out(keys.size());
+    map.getBatch(keys.data(), keys.size(), out.data());
+    for (int i = 0; i < 1000; i++)
+    {
+        myassert((i % 3) ? !out[i] : (out[i] && *out[i] == i / 3));
+    }
+    map.getBatch(keys.data(), 0, out.data());
+}
+
+// increments a counter protected by the lock in more threads than cores
+template <typename LockT>
+void lockTest()
+{
+    LockT lock;
+    int counter = 0;
+    constexpr int numThreads = 16;
+    constexpr int numIter = 20000;
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&]() {
+            for (int i = 0; i < numIter; i++)
+            {
+                std::lock_guard<LockT> guard(lock);
+                counter++;
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    myassert(counter == numThreads * numIter);
+    myassert(lock.try_lock());
+    myassert(!lock.try_lock());
+    lock.unlock();
+}
+
+// a value which can be checked for torn reads
+struct CheckedPair
+{
+    int a;
+    int b;
+};
+
+void flatMapTest()
+{
+    FlatHashMap<PolicyCanRemove, int, CheckedPair> map(16);
+    constexpr int numKeys = 100000;
+    constexpr int numThreads = 4;
+    std::atomic<bool> done = {{false}};
+    std::thread reader([&]() {
+        while (!done)
+        {
+            for (int i = 0; i < numKeys; i += 97)
+            {
+                CheckedPair v;
+                if (map.get(i, v))
+                {
+                    myassert(v.a % numKeys == i && v.b == -v.a);
+                }
+            }
+        }
+    });
+    std::thread threads[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t] = std::thread([&map, t]() {
+            for (int i = t; i < numKeys; i += numThreads)
+            {
+                CheckedPair old;
+                myassert(map.setIfAbsent(i, CheckedPair{i, -i}, old));
+                myassert(!map.setIfAbsent(i, CheckedPair{i, -i}, old) && old.a == i);
+                map.set(i, CheckedPair{i + numKeys, -i - numKeys});
+                if (i % 3 == 0)
+                {
+                    map.remove(i);
+                }
+            }
+        });
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+    }
+    done = true;
+    reader.join();
+    for (int i = 0; i < numKeys; i++)
+    {
+        CheckedPair v;
+        bool found = map.get(i, v);
+        myassert(found == (i % 3 != 0));
+        myassert(!found || (v.a == i + numKeys && v.b == -v.a));
+    }
+    myassert(map.size() == numKeys - (numKeys + 2) / 3);
+    myassert(map.capacity() >= map.size());
+    bool thrown = false;
+    try
+    {
+        map.remove(0);
+    }
+    catch (std::runtime_error &)
+    {
+        thrown = true;
+    }
+    myassert(thrown);
+    map.garbageCollect();
+
+    // removing and inserting the keys leaves DELETED slots, which are cleaned without growing the table
+    FlatHashMap<PolicyCanRemove, int, int> map2(1024);
+    auto cap = map2.capacity();
+    for (int i = 0; i < 100000; i++)
+    {
+        map2.set(i, i);
+        if (i >= 100)
+        {
+            map2.remove(i - 100);
+        }
+    }
+    myassert(map2.size() == 100);
+    myassert(map2.capacity() == cap);
+    for (int i = 0; i < 100000; i++)
+    {
+        int v;
+        bool found = map2.get(i, v);
+        myassert(found == (i >= 100000 - 100));
+        myassert(!found || v == i);
+    }
+    map2.garbageCollect();
+
+    FlatHashMap<PolicyNoRemove, int, int> map3(1);
+    for (int i = 0; i < 5000; i++)
+    {
+        map3.set(i, i);
+    }
+    for (int i = 0; i < 5000; i++)
+    {
+        int v;
+        myassert(map3.get(i, v) && v == i);
+    }
+    printf("Flat map test done, capacity=%zu\n", map.capacity());
+}
+
+// allocates and frees objects in the pool, and uses the pool in a map
+void poolTest()
+{
+    {
+        MemoryPool pool(20, 1024);
+        std::vector<void *> ptrs;
+        for (int i = 0; i < 1000; i++)
+        {
+            auto p = (char *)pool.alloc();
+            memset(p, i, 20);
+            ptrs.push_back(p);
+        }
+        std::sort(ptrs.begin(), ptrs.end());
+        myassert(std::unique(ptrs.begin(), ptrs.end()) == ptrs.end());
+        for (auto p : ptrs)
+        {
+            myassert(uintptr_t(p) % 8 == 0);
+            pool.dealloc(p);
+        }
+        // freed objects should be recycled, no new pages are allocated
+        auto pages = pool.pageList;
+        std::vector<void *> ptrs2;
+        for (int i = 0; i < 1000; i++)
+        {
+            ptrs2.push_back(pool.alloc());
+        }
+        myassert(pool.pageList == pages);
+        std::sort(ptrs2.begin(), ptrs2.end());
+        myassert(std::unique(ptrs2.begin(), ptrs2.end()) == ptrs2.end());
+    }
+    {
+        MemoryPool pool(sizeof(int), 4096);
+        std::thread threads[4];
+        for (int t = 0; t < 4; t++)
+        {
+            threads[t] = std::thread([&pool, t]() {
+                int *held[16] = {nullptr};
+                for (int i = 0; i < 100000; i++)
+                {
+                    auto &slot = held[i % 16];
+                    if (slot)
+                    {
+                        myassert(*slot == t * 1000000 + i - 16);
+                        pool.dealloc(slot);
+                    }
+                    slot = (int *)pool.alloc();
+                    *slot = t * 1000000 + i;
+                }
+                for (auto p : held)
+                {
+                    pool.dealloc(p);
+                }
+            });
+        }
+        for (int t = 0; t < 4; t++)
+        {
+            threads[t].join();
+        }
+    }
+    ConHashMap<PolicyCanRemove, int, int, std::hash<int>, std::equal_to<int>, MemoryPool> map(16);
+    for (int i = 0; i < 10000; i++)
+    {
+        map.set(i, i);
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        map.remove(i);
+    }
+    map.garbageCollect();
+    for (int i = 0; i < 10000; i++)
+    {
+        auto ret = map.get(i);
+        myassert((i % 2) ? (ret && *ret == i) : !ret);
+    }
+    printf("Pool test done\n");
+}
+
 int main()
 {
     removalTest();
+    gcTest();
+    reclaimTest();
+    hazardPointerTest();
+    readGuardTest();
+    resizeTest();
+    poolTest();
+    hashTest();
+    computeTest();
+    incrementTest();
+    emplaceTest();
+    sliceTest();
+    iterateTest();
+    bulkInsertTest();
+    snapshotTest();
+    freezeTest();
+    statsTest();
+    batchTest();
+    lockTest<SpinLock>();
+    lockTest<TTASSpinLock>();
+    lockTest<FutexLock>();
+    flatMapTest();
     using RemovableMap = ConHashMap<PolicyCanRemove, int, int>;
     using NonRemovableMap = ConHashMap<PolicyNoRemove, int, int>;
     printf("Testing NonRemovableMap\n");
@@ -189,4 +1382,12 @@ int main()
         vec[i] = 0;
     }
     randomTest<3, PolicyCanRemove>([](RemovableMap &map) { map.garbageCollect(); }, [](RemovableMap &map, int idx) { map.remove(idx); });
+
+    using HazardPointerMap = ConHashMap<PolicyHazardPointer, int, int>;
+    printf("Testing HazardPointerMap\n");
+    for (int i = 0; i < bufsize; i++)
+    {
+        vec[i] = 0;
+    }
+    randomTest<3, PolicyHazardPointer>([](HazardPointerMap &map) { map.garbageCollect(); }, [](HazardPointerMap &map, int idx) { map.remove(idx); });
 }
\ No newline at end of file